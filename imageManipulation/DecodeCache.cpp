@@ -0,0 +1,208 @@
+#include "global.h"
+
+
+const char DecodeCache::magic[8] = { 'G', 'F', 'X', 'R', 'A', 'W', '1', 0 };
+const size_t DecodeCache::dataOffset = 4096;
+
+// FNV-1a, 64-bit. Not cryptographic, but we only need to notice change
+static const unsigned long long fnvBasis = 14695981039346656037ull;
+static const unsigned long long fnvPrime = 1099511628211ull;
+
+static unsigned long long fnv1a(const void* data, size_t length,
+	unsigned long long hash = fnvBasis) {
+
+	const uchar* in = (const uchar*)data;
+	for (size_t it = 0; it < length; it++)
+		hash = (hash ^ in[it]) * fnvPrime;
+
+	return hash;
+
+}
+
+// the bytes of pixel data after the header, as an Image would store them
+static size_t storageBytes(uint w, uint h, uchar c, PixelFormat format) {
+
+	return paddedStride((size_t)w * c, formatSize(format), c) * h * formatSize(format);
+
+}
+
+// the whole of an entry, mapped copy-on-write so an Image can scribble on
+//  its pixels without touching the file. nullptr if it can't be
+static shared_ptr<uchar> mapEntry(const string& entry, size_t& length) {
+
+	HANDLE file = CreateFileA(entry.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && (size.QuadPart > 0))
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+
+	if (mapping == nullptr)
+		return nullptr;
+
+	// the view keeps the mapping (and the file) alive from here on
+	void* base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (base == nullptr)
+		return nullptr;
+
+	length = (size_t)size.QuadPart;
+	return shared_ptr<uchar>((uchar*)base, [](uchar* p) { UnmapViewOfFile(p); });
+
+}
+
+
+// nothing to open until we're asked for something
+DecodeCache::DecodeCache(const string& dir) : directory(dir), hits(0), misses(0) {
+
+	CreateDirectoryA(directory.c_str(), nullptr);	// already there is fine
+
+}
+
+// the same file by two names should be the same entry, so use the full path
+string DecodeCache::entryFor(const char* file, PixelFormat format) const {
+
+	char full[MAX_PATH];
+	DWORD length = GetFullPathNameA(file, MAX_PATH, full, nullptr);
+	string path = ((length > 0) && (length < MAX_PATH)) ? string(full, length) : string(file);
+
+	uchar tag = (uchar)format;
+	unsigned long long key = fnv1a(&tag, 1, fnv1a(path.data(), path.size()));
+
+	std::ostringstream name;
+	name << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".raw";
+	return name.str();
+
+}
+
+// read it a chunk at a time; the whole file never needs to be in memory
+unsigned long long DecodeCache::hash(const char* file) {
+
+	ifstream in(file, std::ios::binary);
+	if (!in)
+		return 0;
+
+	vector<char> chunk(1 << 16);
+	unsigned long long out = fnvBasis;
+	while (in) {
+
+		in.read(chunk.data(), chunk.size());
+		out = fnv1a(chunk.data(), (size_t)in.gcount(), out);
+	}
+
+	return out;
+
+}
+
+// written beside the entry, then renamed over it, so a reader in another
+//  process sees either the old entry or the new one and never half of one
+bool DecodeCache::store(const string& entry, const Header& header, const Image& image) const {
+
+	std::ostringstream temp;
+	temp << entry << "." << GetCurrentThreadId() << ".tmp";
+
+	{
+		ofstream out(temp.str(), std::ios::binary);
+		vector<char> padding(dataOffset - sizeof(Header), 0);
+
+		out.write((const char*)&header, sizeof(Header));
+		out.write(padding.data(), padding.size());
+		out.write((const char*)image.view().bytes(),
+			storageBytes(header.w, header.h, header.c, header.fmt));
+
+		if (!out)
+		{
+			out.close();
+			std::remove(temp.str().c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileExA(temp.str().c_str(), entry.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		std::remove(temp.str().c_str());
+		return false;
+	}
+
+	return true;
+
+}
+
+// check cheaply, then less cheaply, and only decode as a last resort
+shared_ptr<Image> DecodeCache::load(const char* file, PixelFormat format, ImagePool* buffers) {
+
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(file, GetFileExInfoStandard, &info))
+		return nullptr;
+
+	unsigned long long size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	unsigned long long modified = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) |
+		info.ftLastWriteTime.dwLowDateTime;
+
+	// is there an entry for this file, and does it hold what it says it does?
+	string entry = entryFor(file, format);
+	size_t length = 0;
+	shared_ptr<uchar> mapped = mapEntry(entry, length);
+
+	Header header;
+	bool found = (mapped != nullptr) && (length >= dataOffset);
+	if (found)
+	{
+		memcpy((void*)&header, mapped.get(), sizeof(Header));
+		found = (memcmp(header.magic, magic, sizeof(magic)) == 0) && (header.fmt == format) &&
+			(length >= dataOffset + storageBytes(header.w, header.h, header.c, header.fmt));
+	}
+
+	// same size and time is good enough. Otherwise the contents decide, and
+	//  if they haven't changed then the entry just needs the new time
+	bool current = found && (header.size == size) && (header.modified == modified);
+	unsigned long long content = 0;
+	if (found && !current && (header.size == size))
+	{
+		content = hash(file);
+		current = (content == header.hash);
+
+		if (current)
+		{
+			std::fstream out(entry, std::ios::binary | std::ios::in | std::ios::out);
+			out.seekp(offsetof(Header, modified));
+			out.write((const char*)&modified, sizeof(modified));
+		}
+	}
+
+	if (current)
+	{
+		hits++;
+		return make_shared<Image>(header.w, header.h, header.c, header.fmt,
+			shared_ptr<uchar>(mapped, mapped.get() + dataOffset));
+	}
+
+	// a miss; decode as usual, and remember it for next time
+	misses++;
+	mapped = nullptr;
+
+	shared_ptr<Image> out = Image::from(ImageView::decode(file, format), buffers);
+	if (out == nullptr)
+		return nullptr;
+
+	memset((void*)&header, 0, sizeof(Header));	// no stray bytes in the padding
+	memcpy(header.magic, magic, sizeof(magic));
+	header.size = size;
+	header.modified = modified;
+	header.hash = (content != 0) ? content : hash(file);
+	header.w = out->width();
+	header.h = out->height();
+	header.c = out->channels();
+	header.fmt = format;
+
+	if (!store(entry, header, *out))
+		cerr << endl << "* ERROR: Could not cache \"" << file << "\"." << endl;
+
+	return out;
+
+}
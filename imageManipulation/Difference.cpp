@@ -1,16 +1,25 @@
 #include "global.h"
 
+// STB's buffers start on a cache line, so Image::from() can adopt them
+#define STBI_MALLOC(size) _aligned_malloc(size, rowAlignment)
+#define STBI_REALLOC(pointer, size) _aligned_realloc(pointer, size, rowAlignment)
+#define STBI_FREE(pointer) _aligned_free(pointer)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 
 // define these static entities here
-//vector<shared_ptr<Image>> Difference::imageVector;
-//vector<DiffResult> Difference::state;
-//mutex Difference::dataLock;
+vector<shared_ptr<Image>> Difference::imageVector;
+vector<DiffResult> Difference::state;
+mutex Difference::dataLock;
+vector<bool> Difference::settled;
+function<void(const ProgressSnapshot&)> Difference::observer;
+JobProgress Difference::progress;
 
-//atomic<int> Difference::activeThreads;
-//const double Difference::maxPrecisLoss = 16.0;
+const uint Difference::blockImages = 16;
+const size_t Difference::cacheBudget = 512 * 1024;
+const size_t Difference::streamBudget = 256 * 1024 * 1024;
+const uint Difference::decodeWindow = 32;
 
 
 
@@ -42,291 +51,1071 @@ shared_ptr<SimpleTexture> Difference::loadImageDataIntoTexture(const char* file,
 {
 	cout << "* Attempting to load image \"" << file << "\"." << endl;
 
-	// call STB
-	int width, height, channels;
-	float* pixels = stbi_loadf(file, &width, &height, &channels, 0);
+	// call STB, and hang on to its buffer rather than copying it
+	ImageView view = ImageView::decode(file);
 
-	// null return? ERROR
-	if (pixels == nullptr)
+	// invalid return? ERROR
+	if (!view.valid())
 	{
 
 		cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
 		return NULL;
 	}
 
-	shared_ptr<SimpleTexture> texture = make_shared<SimpleTexture>(width, height, GL_RGB8);
+	// pick a format to match what STB gave us
+	GLenum format;
+	switch (view.channels())
+	{
+	case 1:
+		format = GL_R8;
+		break;
+	case 3:
+		format = GL_RGB8;
+		break;
+	case 4:
+		format = GL_RGBA8;
+		break;
+	default:
+		cerr << endl << "* ERROR: \"" << file << "\" has an unsupported number of channels." << endl;
+		return NULL;
+	}
+
+	shared_ptr<SimpleTexture> texture = make_shared<SimpleTexture>(view.width(), view.height(), format);
 
 	// set up sampling
 	texture->setDownsampler(GL_NEAREST);
 	texture->setUpsampler(GL_NEAREST);
 	texture->setWrapping(GL_MIRRORED_REPEAT);
 
+	// stbi_loadf() starts in the top left, textures sample from bottom left,
+	//  so upload the rows bottom-up instead of storing a reversed copy
+	if (!texture->load(view, true))
+		return NULL;
 
-	int numPixels = width*height*channels;
+	return texture;
+}
 
-	vector<GLfloat> imageData(numPixels);
+vector<GLfloat> Difference::getVectorOfImageData(const char* file)
+{
+	cout << "* Attempting to load image \"" << file << "\"." << endl;
 
-	cout << "\nI store the image data in reverse order.\n";
-	cout << "stbi_loadf() starts in the top left, textures sample from bottom left.\n";
+	// call STB
+	ImageView view = ImageView::decode(file);
 
-	
-	for (int i = 0; i < numPixels; i++)
-	{
-		imageData[numPixels - i - 1] = (pixels[i]);
+	// invalid return? ERROR
+	if (!view.valid()) {
+
+		cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
+		return vector<GLfloat>(1,-1);
 	}
 
+	// one copy, straight out of the decoder's buffer (which the view frees)
+	const GLfloat* pixels = view.data();
+	return vector<GLfloat>(pixels, pixels + view.pixels() * view.channels());
+}
 
-	texture->load(imageData);
 
-	return texture;
+// compare two views, reading each component exactly once
+DiffResult Difference::measure(const ImageView& first, const ImageView& second) {
+
+	ErrorSums sums;
+
+	// nothing sensible to say about these
+	if (!first.valid() || !second.valid() ||
+		(first.width() != second.width()) ||
+		(first.height() != second.height()) ||
+		(first.channels() != second.channels()))
+		return sums.result();
+
+	sums.add(first, second);
+	return sums.result();
+
 }
 
-vector<GLfloat> Difference::getVectorOfImageData(const char* file)
+
+
+// the headless routine: every file against every other
+int Difference::compare(const vector<string>& files, const char* output,
+	const CompareOptions& options)
 {
-	cout << "* Attempting to load image \"" << file << "\"." << endl;
+	// one against many needs only the many
+	if (!options.reference.empty())
+		return compareReference(files, output, options);
 
-	// call STB
-	int width, height, channels;
-	GLfloat* pixels = stbi_loadf(file, &width, &height, &channels, 0);
+	uint count = (uint)files.size();
+	if (count < 2)
+	{
+		cerr << endl << "* ERROR: you must supply at least two images to compare." << endl;
+		return -1;
+	}
 
-	vector<GLfloat> imageData(width*height*channels);
+	// a short list needs none of the matrix, verdicts none of the metrics, and
+	//  estimates only a sample of the pixels
+	if (options.top > 0)
+		return compareTop(files, output, options);
+	if (!isnan(options.threshold))
+		return compareThreshold(files, output, options);
+	if (!isnan(options.tolerance))
+		return compareEstimated(files, output, options);
+
+	Job job(options, count);
+	ThreadPool& pool = job.pool;
+	PixelFormat format = job.format;
+	state.assign(((ulong)count * (count - 1)) >> 1, DiffResult());
+	settled.assign(state.size(), false);
+
+	job.announce("Comparing " + std::to_string(count) + " images",
+		options.stream ? ", streaming" : "");
+
+	bool similar = options.similarity && !options.stream && !options.exact;
+
+	// whatever the store already knows about these contents needn't be
+	//  compared again. Reading every file is far cheaper than decoding it
+	shared_ptr<ResultStore> store;
+	vector<unsigned long long> hashes(count, 0);
+	bool readable = true;
+	if (!options.store.empty())
+	{
+		store = make_shared<ResultStore>(options.store);
+		for (uint it = 0; it < count; it++)
+			pool.submit([&files, &hashes, it]() { hashes[it] = DecodeCache::hash(files[it].c_str()); });
+		drain(pool);
+
+		for (uint it = 0; it < count; it++)
+			if (hashes[it] == 0)
+			{
+				cerr << endl << "* ERROR: Could not read \"" << files[it] << "\"." << endl;
+				readable = false;
+			}
 
-	// null return? ERROR
-	if (pixels == nullptr) {
+		ulong known = 0;
+		for (uint y = 1; y < count; y++)
+			for (uint x = 0; x < y; x++)
+			{
+				// an unreadable file can't be compared, so don't load its partners for it
+				DiffResult& result = state[linearize(x, y)];
+				if ((hashes[x] == 0) || (hashes[y] == 0))
+				{
+					result = ErrorSums().result();
+					result.x = x;
+					result.y = y;
+					settled[linearize(x, y)] = true;
+					continue;
+				}
 
-		cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
-		return vector<GLfloat>(1,-1);
+				if (!store->find(hashes[x], hashes[y], format, result) ||
+					(similar && isnan(result.ssim)))
+				{
+					result = DiffResult();
+					continue;
+				}
+
+				result.x = x;
+				result.y = y;
+				settled[linearize(x, y)] = true;
+				known++;
+			}
+
+		cout << "* " << known << " of " << state.size() << " pairs came from \"" <<
+			options.store << "\"." << endl;
 	}
-	else
-		for (int i = 0; i < width*height*channels; i++)
-			imageData.push_back(pixels[i]);
 
+	// with a radius, most pairs are ruled out before anything's compared
+	int radius = ((options.radius >= 0) && (options.radius <= 64)) ? options.radius : -1;
+
+	vector<ErrorSums> sums(state.size());
+	bool complete = options.stream ?
+		compareStreaming(pool, sums, files, output, job.cache.get(), &job.buffers, format, radius) :
+		compareInMemory(pool, sums, files, job.cache.get(), &job.buffers, format, radius);
+	job.report();
+
+	for (uint y = 1; y < count; y++)
+		for (uint x = 0; x < y; x++)
+			if (!settled[linearize(x, y)])
+			{
+				DiffResult& result = state[linearize(x, y)];
+				result = sums[linearize(x, y)].result();
+				result.x = x;
+				result.y = y;
+			}
+
+	// SSIM needs whole images, with their neighbourhoods, so it's a pass of
+	//  its own. Each pair writes only its own result, so no lock is needed
+	if (options.similarity && options.stream)
+		cout << "* SSIM needs whole images, so it's skipped when streaming." << endl;
+	else if (options.similarity && options.exact)
+		cout << "* SSIM needs float images, so it's skipped in exact mode." << endl;
+
+	if (similar)
+	{
+		for (uint y = 1; y < count; y++)
+			for (uint x = 0; x < y; x++)
+				if ((imageVector[x] != nullptr) && (imageVector[y] != nullptr) &&
+					!settled[linearize(x, y)])
+					pool.submit([x, y, &job]()
+					{
+						Similarity found = similarity(imageVector[x]->view(), imageVector[y]->view(),
+							nullptr, &job.buffers);
+
+						DiffResult& result = state[linearize(x, y)];
+						result.ssim = found.ssim;
+						result.msssim = found.msssim;
+					});
+		drain(pool);
+	}
+
+	// remember whatever was actually compared, for next time
+	if (store)
+	{
+		for (uint y = 1; y < count; y++)
+			for (uint x = 0; x < y; x++)
+			{
+				int index = linearize(x, y);
+				if (!settled[index] && (sums[index].count > 0) && (hashes[x] != 0) && (hashes[y] != 0))
+					store->put(hashes[x], hashes[y], format, state[index]);
+			}
+
+		if (!store->save())
+			cerr << endl << "* ERROR: Could not save \"" << options.store << "\"." << endl;
+	}
 
-	return imageData;
+	// write it out in the same layout as before, plus SSIM if we have it
+	bool written = writeMatrix(output, count,
+		similar ? "PSNR / RMSE / MAE / SSIM / MS-SSIM" : "PSNR / RMSE / MAE",
+		[similar](ofstream& out, const DiffResult& result)
+		{
+			out << result.psnr << "dB / " << result.rmse << " / " << result.mae;
+			if (similar)
+				out << " / " << result.ssim << " / " << result.msssim;
+		});
+
+	// did everything make it in?
+	return (written && complete && readable) ? 0 : -1;
 }
 
 
+// set up what every mode needs
+Difference::Job::Job(const CompareOptions& options, uint images) :
+	format(options.exact ? PixelFormat::UINT8 : PixelFormat::FLOAT32), exact(options.exact)
+{
+	imageVector.assign(images, nullptr);
+	state.clear();
+	settled.clear();
+	observer = options.observer;
+	progress.begin();
+
+	// decoding costs more than comparing, so skip it where we can
+	if (!options.cache.empty())
+		cache = make_shared<DecodeCache>(options.cache);
+}
 
-/*
-// convert an image into an Image
-void Difference::loadImage(const char* file, uint index) {
+// the frames go before the pool they came from, and nothing stale is
+//  left for the next job
+Difference::Job::~Job()
+{
+	imageVector.clear();
+}
 
-	// increment our atomics
-	activeThreads++;
+void Difference::Job::announce(const string& what, const string& how) const
+{
+	cout << "* " << what << " on " << pool.size() << " threads" << how <<
+		(exact ? ", exactly in 8 bits" : "") << "." << endl;
+}
 
-	cout << "* Attempting to load image \"" << file << "\"." << endl;
+void Difference::Job::report() const
+{
+	if (cache)
+		cout << "* " << cache->hitCount() << " images came from the cache, " <<
+			cache->missCount() << " had to be decoded." << endl;
+
+	// how hard the pool worked, and the most memory the images ever took
+	PoolStats pooled = buffers.stats();
+	if (pooled.allocations + pooled.reuses > 0)
+		cout << "* " << pooled.allocations << " buffers were allocated and " << pooled.reuses <<
+			" reused, with at most " << (pooled.highWater >> 10) << " KiB in use and " <<
+			(pooled.highWaterTotal >> 10) << " KiB held." << endl;
+}
 
-	// call STB
-	int width, height, channels;
-	float* pixels = stbi_loadf(file, &width, &height, &channels, 0);
 
-	// null return? ERROR
-	if (pixels == nullptr) {
+// every pair of state in the symmetric layout the matrix has always had
+bool Difference::writeMatrix(const char* output, uint count, const char* diagonal,
+	const function<void(ofstream&, const DiffResult&)>& cell)
+{
+	ofstream out(output);
+	if (!out)
+	{
+		cerr << endl << "* ERROR: Could not write \"" << output << "\"." << endl;
+		return false;
+	}
 
-		cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
-		activeThreads--;
+	for (uint it = 0; it < count; it++)
+		out << it << ((it + 1 < count) ? "," : "\n");
+
+	for (uint y = 0; y < count; y++)
+	{
+		out << y;
+		for (uint x = 0; x < count; x++)
+		{
+			out << ",";
+			if (x == y)
+				out << diagonal;
+			else
+				cell(out, state[linearize(x, y)]);
+		}
+		out << "\n";
+	}
+
+	cout << "* Wrote \"" << output << "\"." << endl;
+	return true;
+}
+
+
+// wait for the workers, polling the progress for the observer meanwhile
+void Difference::drain(ThreadPool& pool)
+{
+	if (!observer)
+	{
+		pool.wait();
 		return;
 	}
 
-	// create an Image pointer to receive this data
-	shared_ptr<Image> target = make_shared<Image>(width, height, channels);
+	while (!pool.wait(microseconds(1000000)))
+		observer(progress.snapshot());
+	observer(progress.snapshot());
+}
 
-	dataLock.lock();
 
-	// if we're the first, life is easy
-	if (index == 0)
-		imageVector[0] = target;
+// every unsettled pair is about to be compared, or at least those that
+//  made it into imageVector
+void Difference::expectWork(ulong total, PixelFormat format, bool loadedOnly)
+{
+	uint count = (uint)imageVector.size();
 
-	else {
+	ulong pairs = 0;
+	for (uint y = 1; y < count; y++)
+		for (uint x = 0; x < y; x++)
+			if (!settled[linearize(x, y)] &&
+				(!loadedOnly || ((imageVector[x] != nullptr) && (imageVector[y] != nullptr))))
+				pairs++;
 
-		// no first image yet? defer until there is
-		while (imageVector[0] == nullptr) {
+	progress.expect(pairs, (unsigned long long)pairs * 2 * total * formatSize(format));
+}
 
-			dataLock.unlock();
-			Sleep(1000);		// make it quick
-			dataLock.lock();
-		}
 
-		// now that there is, do we match the first image?
-		if ((imageVector[0]->width() != (uint)width) ||
-			(imageVector[0]->height() != (uint)height) ||
-			(imageVector[0]->channels() != (uchar)channels)) {
+// worth loading at all?
+bool Difference::needed(uint image)
+{
+	uint count = (uint)imageVector.size();
+	for (uint other = 0; other < count; other++)
+		if ((other != image) && !settled[linearize(std::min(image, other), std::max(image, other))])
+			return true;
 
-			cerr << endl << "* ERROR: Image \"" << file <<
-				"\" doesn't have the expected size." << endl;
-			activeThreads--;
-			dataLock.unlock();
-			return;
+	return false;
+}
+
+
+// is there anything to compare between these two blocks yet?
+bool Difference::pending(uint first, uint second)
+{
+	uint count = (uint)imageVector.size();
+	uint lastFirst = std::min(count, first + blockImages);
+	uint lastSecond = std::min(count, second + blockImages);
+
+	for (uint b = second; b < lastSecond; b++)
+		for (uint a = first; a < std::min(lastFirst, b); a++)
+			if ((imageVector[a] != nullptr) && (imageVector[b] != nullptr) &&
+				!settled[linearize(a, b)])
+				return true;
+
+	return false;
+}
+
+
+/* Settle every pair the index says is too far apart to be worth comparing,
+*  from the signatures taken as each image was loaded. Only the close pairs
+*  are left for the exact metrics, and an image with no close partner needn't
+*  be kept. An image that wouldn't load has no signature, and so no close pairs. */
+void Difference::prefilter(const vector<Signature>& signatures, uint radius)
+{
+	uint count = (uint)signatures.size();
+
+	SignatureIndex nearby;
+	for (uint it = 0; it < count; it++)
+		if (signatures[it].valid)
+			nearby.insert(signatures[it].phash, it);
+
+	vector<bool> close(settled.size(), false);
+	for (const pair<uint, uint>& found : nearby.pairs(radius))
+		close[linearize(found.first, found.second)] = true;
+
+	ulong kept = 0;
+	for (uint y = 1; y < count; y++)
+		for (uint x = 0; x < y; x++)
+		{
+			int index = linearize(x, y);
+			if (settled[index])
+				continue;
+
+			if (close[index])
+			{
+				kept++;
+				continue;
+			}
+
+			DiffResult& result = state[index];
+			result = ErrorSums().result();
+			result.x = x;
+			result.y = y;
+			settled[index] = true;
 		}
 
-		imageVector[index] = target;
+	cout << "* " << kept << " pairs are within " << radius << " bits of each other." << endl;
+}
+
+
+// the stripe and task sizes for count images shaped like sample
+Difference::BlockPlan Difference::planBlocks(uint count, const Image& sample,
+	uint height, ulong total, uint threads)
+{
+	BlockPlan plan;
+	plan.height = height;
+	plan.total = total;
+
+	// a stripe of two blocks of images should fit in cache, so each
+	//  image is read from memory once per block rather than once per pair
+	size_t rowBytes = sample.rowStride() * formatSize(sample.format());
+	plan.block = std::min(count, blockImages);
+	plan.rows = (uint)std::max((size_t)1, cacheBudget / (2 * plan.block * rowBytes));
+
+	// only the upper triangle of blocks; the matrix is symmetric. If
+	//  that's too few tasks to go around, split the rows between them too
+	uint blocks = (count + plan.block - 1) / plan.block;
+	uint blockPairs = (blocks * (blocks + 1)) >> 1;
+	uint stripes = (height + plan.rows - 1) / plan.rows;
+	uint groups = std::max(1u, std::min(stripes, (4 * threads + blockPairs - 1) / blockPairs));
+	plan.span = ((stripes + groups - 1) / groups) * plan.rows;
+
+	return plan;
+}
+
+
+// every task for one pair of blocks; both must be in imageVector already
+void Difference::submitBlocks(ThreadPool& pool, vector<ErrorSums>& sums,
+	const BlockPlan& plan, uint first, uint second)
+{
+	if (!pending(first, second))
+		return;		// all settled, or missing
+
+	uint rows = plan.rows;
+	ulong total = plan.total;
+
+	for (uint top = 0; top < plan.height; top += plan.span)
+	{
+		uint bottom = std::min(plan.height, top + plan.span);
+		pool.submit([&sums, first, second, top, bottom, rows, total]() {
+			compareBlock(sums, first, second, top, bottom, rows, total); });
 	}
+}
 
-	dataLock.unlock();
 
-	// now start adding the raw data into the image
-	ulong pixel = 0;
-	for (int y = 0; y < height; y++)
-		for (int x = 0; x < width; x++)
-			for (char c = 0; c < channels; c++)
-				(*target)[y][x].set(c, pixels[pixel++]);
+// hand out the blocks of pairs over rows [0, height) of whatever's in
+//  imageVector, and wait for them to finish
+void Difference::scheduleBlocks(ThreadPool& pool, vector<ErrorSums>& sums,
+	uint height, ulong total)
+{
+	uint count = (uint)imageVector.size();
+
+	// the first image that made it sets the shape of the rest
+	const Image* sample = nullptr;
+	for (const shared_ptr<Image>& image : imageVector)
+		if (image != nullptr)
+		{
+			sample = image.get();
+			break;
+		}
 
-	// free up the buffer
-	stbi_image_free(pixels);
+	if ((sample == nullptr) || (height == 0))
+		return;
 
-	// flag we're finished and exit
-	activeThreads--;
+	BlockPlan plan = planBlocks(count, *sample, height, total, pool.size());
+	for (uint second = 0; second < count; second += plan.block)
+		for (uint first = 0; first <= second; first += plan.block)
+			submitBlocks(pool, sums, plan, first, second);
 
+	drain(pool);
 }
-*/
 
-/*
-// calculate the metric we're interested in
-void Difference::calcMetrics(uint a, uint b) {
 
-	// a = x, b = y, y > x in all cases
+/* Every image decoded and kept in memory, with the decoding and comparing
+*  overlapped. The pairs go out a block at a time, since compareBlock reads a
+*  stripe of every image in both its blocks at once and that's what keeps it
+*  in cache. But the decodes are taken in whatever order they finish, and a
+*  block is ready as soon as its own images are; its pairs with itself and
+*  every other ready block go to the workers then, queued behind (and so
+*  running alongside) the decodes still going. So a slow decode holds back
+*  only the pairs of its own block. No more than decodeWindow decodes are out
+*  at once, so the decoders' scratch memory stays bounded and the compares
+*  never wait behind a wall of them. With a radius, each image is signed on
+*  the worker that decoded it, and nothing is compared until every signature
+*  is in and the pairs too far apart are settled. */
+bool Difference::compareInMemory(ThreadPool& pool, vector<ErrorSums>& sums,
+	const vector<string>& files, DecodeCache* cache, ImagePool* buffers, PixelFormat format,
+	int radius)
+{
+	uint count = (uint)files.size();
+	uint block = std::min(count, blockImages);
+	uint blocks = (count + block - 1) / block;
+
+	// each decode hands its index back as it finishes
+	vector<shared_ptr<Image>> loaded(count);
+	deque<uint> arrivals;
+	mutex arriving;
+	condition_variable arrived;
+
+	bool signing = (radius >= 0);
+	vector<Signature> signatures(count);
+
+	vector<bool> wanted(count, false);
+	vector<bool> done(count, false);
+	vector<uint> waiting(blocks, 0);	// images per block not yet in
+	for (uint it = 0; it < count; it++)
+		waiting[it / block]++;
+
+	uint finished = 0;
+	auto land = [&](uint it)
+	{
+		done[it] = true;
+		waiting[it / block]--;
+		finished++;
+	};
+
+	uint submitted = 0;
+	uint outstanding = 0;
+	auto decodeMore = [&]()
+	{
+		for (; (submitted < count) && (outstanding < decodeWindow); submitted++)
+		{
+			uint it = submitted;
+			wanted[it] = needed(it);
+			if (!wanted[it])
+			{
+				land(it);		// every pair it's in is settled
+				continue;
+			}
+
+			outstanding++;
+			pool.submit([&files, &loaded, &signatures, &arrivals, &arriving, &arrived, it, cache,
+				buffers, format, signing]()
+			{
+				shared_ptr<Image> image = loadImage(files[it].c_str(), cache, format, buffers);
+				if (signing && (image != nullptr))
+					signatures[it] = Signature::of(image->view());
+
+				std::lock_guard<mutex> guard(arriving);
+				loaded[it] = image;
+				arrivals.push_back(it);
+				arrived.notify_one();
+			});
+		}
+	};
+
+	// everything has to match the first image that loads, as in loadAll.
+	//  Pairs with a missing image are skipped, and come out as NaN
+	shared_ptr<Image> first;
+	uint scan = 0;
+	bool complete = true;
+	BlockPlan plan;
+	vector<bool> ready(blocks, false);
+
+	decodeMore();
+	while (finished < count)
+	{
+		uint it = 0;
+		{
+			unique_lock<mutex> guard(arriving);
+			while (arrivals.empty())
+				if ((arrived.wait_for(guard, microseconds(1000000)) == std::cv_status::timeout) &&
+					observer)
+				{
+					guard.unlock();
+					observer(progress.snapshot());
+					guard.lock();
+				}
+
+			it = arrivals.front();
+			arrivals.pop_front();
+		}
+
+		if (loaded[it] == nullptr)
+			complete = false;
+
+		outstanding--;
+		land(it);
+		decodeMore();
+
+		// once every signature is in, let go of anything with no close partner
+		if (signing)
+		{
+			if (finished < count)
+				continue;
+
+			prefilter(signatures, (uint)radius);
+			signing = false;
+			for (uint image = 0; image < count; image++)
+				if (!needed(image))
+					loaded[image] = nullptr;
+		}
+
+		// the shape is settled once everything before the first success is in
+		for (; (first == nullptr) && (scan < count) && done[scan]; scan++)
+			if (loaded[scan] != nullptr)
+			{
+				first = loaded[scan];
+				ulong total = first->pixels() * first->channels();
+				plan = planBlocks(count, *first, first->height(), total, pool.size());
 
-	// increment our atomics
-	activeThreads++;
+				// until we know better, assume everything will load
+				expectWork(total, format, false);
+			}
 
-	if (a > b) {		// shoot, gotta fix this
+		if (first == nullptr)
+			continue;
+
+		for (uint b = 0; b < blocks; b++)
+		{
+			if (ready[b] || (waiting[b] > 0))
+				continue;
+
+			for (uint image = b * block; image < std::min(count, (b + 1) * block); image++)
+			{
+				shared_ptr<Image> candidate = loaded[image];
+				loaded[image] = nullptr;
+				if (candidate == nullptr)
+					continue;
+
+				if ((candidate->width() != first->width()) ||
+					(candidate->height() != first->height()) ||
+					(candidate->channels() != first->channels()))
+				{
+					cerr << endl << "* ERROR: Image \"" << files[image] <<
+						"\" doesn't have the expected size." << endl;
+					complete = false;
+					continue;
+				}
 
-		uint temp = a;
-		a = b;
-		b = temp;
+				imageVector[image] = candidate;
+			}
+
+			// this block is in, so pair it with every other block that is
+			ready[b] = true;
+			for (uint other = 0; other < blocks; other++)
+				if (ready[other])
+					submitBlocks(pool, sums, plan, std::min(b, other) * block,
+						std::max(b, other) * block);
+		}
 	}
 
-	// create these before locking
-	shared_ptr<Image> first = nullptr;
-	shared_ptr<Image> second = nullptr;
+	// nothing needed, or nothing usable, leaves nothing more to expect
+	if (first != nullptr)
+		expectWork(plan.total, format);
 
-	DiffResult results;
-	results.x = a;
-	results.y = b;
+	drain(pool);
+	return complete;
+}
 
-	uint resultsIndex;
 
-	dataLock.lock();
+// everything decoded up front, for the modes that don't overlap the two
+bool Difference::loadAll(ThreadPool& pool, const vector<string>& files,
+	DecodeCache* cache, ImagePool* buffers, PixelFormat format,
+	const function<void(uint, const Image&)>& prepare)
+{
+	uint count = (uint)files.size();
 
-	// store our results
-	resultsIndex = state.size();
-	state.push_back(results);
+	vector<future<shared_ptr<Image>>> loads(count);
+	uint submitted = 0;
 
-	// are we out of bounds? nullptrs?
-	if ((a >= imageVector.size()) || (b >= imageVector.size()) ||
-		(imageVector[a] == nullptr) || (imageVector[b] == nullptr)) {
+	// everything has to match the first image that loads
+	shared_ptr<Image> first;
+	bool complete = true;
+	for (uint it = 0; it < count; it++)
+	{
+		for (; submitted < std::min(count, it + decodeWindow); submitted++)
+		{
+			uint next = submitted;
+			loads[next] = pool.async([&files, &prepare, next, cache, buffers, format]()
+			{
+				shared_ptr<Image> image = loadImage(files[next].c_str(), cache, format, buffers);
+				if ((image != nullptr) && prepare)
+					prepare(next, *image);
+				return image;
+			});
+		}
 
-		// nevermind
-		dataLock.unlock();
-		activeThreads--;
-		return;
+		shared_ptr<Image> image = collect(loads[it]);
+		if (image == nullptr)
+		{
+			complete = false;
+			continue;
+		}
+
+		if (first == nullptr)
+			first = image;
+
+		if ((image->width() != first->width()) || (image->height() != first->height()) ||
+			(image->channels() != first->channels()))
+		{
+			cerr << endl << "* ERROR: Image \"" << files[it] <<
+				"\" doesn't have the expected size." << endl;
+			complete = false;
+			continue;
+		}
+
+		imageVector[it] = image;
 	}
 
-	// otherwise, retrieve the appropriate images
-	first = imageVector[a];
-	second = imageVector[b];
+	return complete;
+}
+
+
+/* Whole images in memory and a task per pair, for the modes that measure
+*  each pair on its own rather than a block of them at once. Every image's
+*  maximum is found just the once, on the worker that decoded it, so measure
+*  can have it for nothing. The results go out in the matrix layout, each
+*  cell as cell writes it. */
+int Difference::comparePairs(const vector<string>& files, const char* output,
+	const CompareOptions& options, const char* mode, const char* diagonal,
+	const function<DiffResult(const Image&, const Image&)>& measure,
+	const function<void(ofstream&, const DiffResult&)>& cell)
+{
+	uint count = (uint)files.size();
+
+	Job job(options, count);
+	ThreadPool& pool = job.pool;
+	PixelFormat format = job.format;
+	state.assign(((ulong)count * (count - 1)) >> 1, ErrorSums().result());	// NaN if missing
+	settled.assign(state.size(), false);
+
+	job.announce("Comparing " + std::to_string(count) + " images", string(", ") + mode);
+
+	if (options.stream || options.similarity || !options.store.empty() || (options.radius >= 0))
+		cout << "* Only the cache applies here; streaming, SSIM, the store and the radius don't." <<
+			endl;
+
+	bool complete = loadAll(pool, files, job.cache.get(), &job.buffers, format,
+		[](uint, const Image& image) { image.max(); });
+	job.report();
+
+	ulong total = 0;
+	ulong pairs = 0;
+	for (uint y = 1; y < count; y++)
+		for (uint x = 0; x < y; x++)
+			if ((imageVector[x] != nullptr) && (imageVector[y] != nullptr))
+			{
+				total = imageVector[x]->pixels() * imageVector[x]->channels();
+				pairs++;
+			}
 
-	dataLock.unlock();
+	// the most it could come to, if every pair were read in full
+	progress.expect(pairs, (unsigned long long)pairs * 2 * total * formatSize(format));
+
+	// each task writes only its own result, so no lock is needed
+	for (uint y = 1; y < count; y++)
+		for (uint x = 0; x < y; x++)
+			if ((imageVector[x] != nullptr) && (imageVector[y] != nullptr))
+				pool.submit([x, y, &measure]()
+				{
+					DiffResult& result = state[linearize(x, y)];
+					result = measure(*imageVector[x], *imageVector[y]);
+					result.x = x;
+					result.y = y;
+					progress.finished();
+				});
+	drain(pool);
+
+	bool written = writeMatrix(output, count, diagonal, cell);
+
+	return (written && complete) ? 0 : -1;
+}
 
-	// now, build up the stats
-	vector<double> dsquared; dsquared.push_back(0.0);		// use these to preserve precision
-	uint dsquaredIndex = 0;
-	vector<double> dabs; dabs.push_back(0.0);
-	uint dabsIndex = 0;
 
-	for (uint y = 0; y < first->height(); y++) {
+/* Decode each image once and spill its rows to a raw file beside the output,
+*  as STB can only decode a whole frame at once. Then read every image back a
+*  strip of rows at a time and compare the strips exactly as the in-memory
+*  path would, so at most one strip per image (plus whatever the workers are
+*  decoding) is ever in memory. */
+bool Difference::compareStreaming(ThreadPool& pool, vector<ErrorSums>& sums,
+	const vector<string>& files, const char* output, DecodeCache* cache,
+	ImagePool* buffers, PixelFormat format, int radius)
+{
+	uint count = (uint)files.size();
 
-		for (uint x = 0; x < first->width(); x++)
-			for (uchar c = 0; c < first->channels(); c++) {
+	struct Shape {
 
-				// read-only, so this is fine
-				double temp = (double)((*first)[y][x].get(c) - (*second)[y][x].get(c));
+		uint w = 0, h = 0;
+		uchar c = 0;
+	};
 
-				dsquared[dsquaredIndex] += temp * temp;		// careful to preserve precision
-				if (dsquared[dsquaredIndex] > maxPrecisLoss) {
-					dsquared.push_back(0.0);
-					dsquaredIndex++;
+	vector<Shape> shapes(count);
+	vector<string> spills(count);
+	vector<bool> wanted(count);
+	vector<Signature> signatures(count);
+	bool signing = (radius >= 0);
+
+	for (uint it = 0; it < count; it++)
+	{
+		spills[it] = string(output) + "." + std::to_string(it) + ".raw";
+		wanted[it] = needed(it);
+		if (wanted[it])
+			pool.submit([&files, &spills, &shapes, &signatures, it, cache, buffers, format,
+				signing]()
+			{
+				cout << "* Attempting to load image \"" << files[it] << "\"." << endl;
+
+				// a cached image is mapped, so holding it costs next to nothing
+				shared_ptr<Image> cached;
+				ImageView view;
+				if (cache)
+				{
+					cached = cache->load(files[it].c_str(), format, buffers);
+					if (cached)
+						view = cached->view();
 				}
+				else
+					view = ImageView::decode(files[it].c_str(), format);
 
-				dabs[dabsIndex] += fabs(temp);
-				if (dabs[dabsIndex] > maxPrecisLoss) {
-					dabs.push_back(0.0);
-					dabsIndex++;
+				if (!view.valid())
+				{
+					cerr << endl << "* ERROR: Could not load \"" << files[it] << "\"." << endl;
+					return;
 				}
-			}
 
-		// update our progress
-		dataLock.lock();
-		state[resultsIndex].progress = (float)(y + 1) / (float)first->height();
-		dataLock.unlock();
+				// rows go out tightly packed, whatever the view's stride
+				size_t size = formatSize(format);
+				const char* bytes = (const char*)view.bytes();
+				std::ofstream out(spills[it], std::ios::binary);
+				for (uint y = 0; y < view.height(); y++)
+					out.write(bytes + y * view.rowStride() * size,
+						(size_t)view.width() * view.channels() * size);
+				if (!out)
+				{
+					cerr << endl << "* ERROR: Could not spill \"" << files[it] << "\"." << endl;
+					return;
+				}
 
+				shapes[it].w = view.width();
+				shapes[it].h = view.height();
+				shapes[it].c = view.channels();
+
+				// while it's still decoded, and warm
+				if (signing)
+					signatures[it] = Signature::of(view);
+			});
 	}
+	drain(pool);
 
-	// do our final gathering
-	while (dsquared.size() > 1) {
+	bool complete = true;
+	for (uint it = 0; it < count; it++)
+		complete = complete && (!wanted[it] || (shapes[it].c != 0));
 
-		uint index = 0;
-		while (index < (dsquared.size() - 1)) {
+	// an image with no close partner needn't be read back at all
+	if (signing)
+	{
+		prefilter(signatures, (uint)radius);
+		for (uint it = 0; it < count; it++)
+			wanted[it] = wanted[it] && needed(it);
+	}
 
-			dsquared[index] += dsquared[dsquared.size() - 1];
-			dsquared.pop_back();		// more efficient than deleting a middle element
-			index++;
-		}
+	// everything has to match the first image that loaded, as before
+	uint reference = 0;
+	while ((reference < count) && (!wanted[reference] || (shapes[reference].c == 0)))
+		reference++;
+	const Shape shape = (reference < count) ? shapes[reference] : Shape();
 
+	vector<bool> usable(count, false);
+	for (uint it = 0; it < count; it++)
+	{
+		usable[it] = wanted[it] && (shape.c != 0) && (shapes[it].w == shape.w) &&
+			(shapes[it].h == shape.h) && (shapes[it].c == shape.c);
 
+		if (wanted[it] && (it != reference) && (shapes[it].c != 0) && !usable[it])
+		{
+			cerr << endl << "* ERROR: Image \"" << files[it] <<
+				"\" doesn't have the expected size." << endl;
+			complete = false;
+		}
 	}
 
-	while (dabs.size() > 1) {
+	if (shape.c != 0)
+	{
+		// as many rows per strip as the budget allows for every image at once
+		size_t rowBytes = paddedStride((size_t)shape.w * shape.c, formatSize(format), shape.c) *
+			formatSize(format);
+		uint strip = (uint)std::min((size_t)shape.h,
+			std::max((size_t)1, streamBudget / (count * rowBytes)));
+		ulong total = (ulong)shape.w * shape.h * shape.c;
+
+		cout << "* Streaming strips of " << strip << " rows." << endl;
+
+		// one strip-sized Image per usable image, reused for every strip
+		for (uint it = 0; it < count; it++)
+			if (usable[it])
+				imageVector[it] = make_shared<Image>(shape.w, strip, shape.c, format,
+					ImageLayout::INTERLEAVED, buffers, false);
+		expectWork(total, format);
+
+		for (uint top = 0; top < shape.h; top += strip)
+		{
+			uint height = std::min(strip, shape.h - top);
+
+			for (uint it = 0; it < count; it++)
+				if (usable[it])
+					pool.submit([&spills, &shape, it, top, height, format]()
+					{
+						size_t line = (size_t)shape.w * shape.c * formatSize(format);
+						std::ifstream in(spills[it], std::ios::binary);
+						in.seekg((std::streamoff)(top * line));
+
+						Image& target = *imageVector[it];
+						dispatchFormat(format, [&](auto tag)
+						{
+							typedef typename decltype(tag)::type T;
+							for (uint y = 0; y < height; y++)
+								in.read((char*)target.rowAs<T>(y).data(), line);
+						});
+					});
+			drain(pool);
+
+			scheduleBlocks(pool, sums, height, total);
+		}
+	}
 
-		uint index = 0;
-		while (index < (dabs.size() - 1)) {
+	// tidy up after ourselves
+	imageVector.assign(count, nullptr);
+	for (const string& spill : spills)
+		std::remove(spill.c_str());
 
-			dabs[index] += dabs[dabs.size() - 1];
-			dabs.pop_back();
-			index++;
-		}
+	return complete;
+}
+
+
+// convert an image into an Image
+shared_ptr<Image> Difference::loadImage(const char* file, DecodeCache* cache,
+	PixelFormat format, ImagePool* buffers) {
+
+	cout << "* Attempting to load image \"" << file << "\"." << endl;
+
+	// the cache hands back an Image already, mapped if it's seen this before
+	if (cache) {
+
+		shared_ptr<Image> target = cache->load(file, format, buffers);
+		if (target == nullptr)
+			cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
+
+		return target;
 	}
 
-	double total = 1.0 / (double)(first->pixels() * first->channels());
-	results.mae = dabs[0] * total;
+	// call STB, and keep its buffer if the rows need no padding
+	shared_ptr<Image> target = Image::from(ImageView::decode(file, format), buffers);
 
-	double max = first->max();		// need the maximum value for PSNR
-	double temp = second->max();
-	if (temp > max)
-		max = temp;
+	// null return? ERROR
+	if (target == nullptr)
+		cerr << endl << "* ERROR: Could not load \"" << file << "\"." << endl;
+
+	return target;
+
+}
+
+
+// one block of pairs over a range of rows; see compare()
+void Difference::compareBlock(vector<ErrorSums>& sums, uint first, uint second,
+	uint top, uint bottom, uint rows, ulong total) {
+
+	uint count = (uint)imageVector.size();
+	uint lastFirst = std::min(count, first + blockImages);
+	uint lastSecond = std::min(count, second + blockImages);
+
+	// our own partial sums, in the same order we visit the pairs
+	vector<ErrorSums> local;
+	for (uint b = second; b < lastSecond; b++)
+		for (uint a = first; a < std::min(lastFirst, b); a++)
+			local.push_back(ErrorSums());
+
+	// views without an owner, so the threads don't fight over reference
+	//  counts; imageVector keeps the storage alive
+	vector<ImageView> stripe(count);
+	auto cut = [&stripe](uint it, uint y, uint height) {
+
+		if (imageVector[it] == nullptr)
+			return;		// stays invalid, and is skipped
+
+		const Image& image = *imageVector[it];
+		dispatchFormat(image.format(), [&](auto tag) {
+
+			typedef typename decltype(tag)::type T;
+			stripe[it] = ImageView(image.rowAs<T>(y).data(), image.format(), image.width(),
+				height, image.channels(), image.rowStride());
+		});
+	};
 
-	temp = dsquared[0] * total;
-	results.psnr = 20.0 * log10(max) - 10.0 * log10(temp);
+	for (uint y = top; y < bottom; y += rows) {
 
-	results.rmse = sqrt(temp);
+		uint height = std::min(rows, bottom - y);
+		for (uint it = first; it < lastFirst; it++)
+			cut(it, y, height);
+		for (uint it = second; it < lastSecond; it++)
+			cut(it, y, height);
 
-	results.progress = 1.0;			// we are done, after all
+		// every pair while the stripe is still in cache
+		size_t pair = 0;
+		ulong compared = 0;
+		for (uint b = second; b < lastSecond; b++)
+			for (uint a = first; a < std::min(lastFirst, b); a++, pair++)
+				if (stripe[a].valid() && stripe[b].valid() && !settled[linearize(a, b)]) {
 
-									// update the stats and exit
-	dataLock.lock();
-	state[resultsIndex] = results;
-	dataLock.unlock();
+					local[pair].add(stripe[a], stripe[b]);
+					compared++;
+				}
+
+		// once per stripe, and without a lock
+		if (compared > 0) {
+
+			const ImageView& sample = stripe[second].valid() ? stripe[second] : stripe[first];
+			progress.read((unsigned long long)compared * 2 * sample.pixels() *
+				sample.channels() * formatSize(sample.format()));
+		}
+	}
+
+	// the merge is once per task, rare enough that a lock costs nothing
+	std::lock_guard<mutex> guard(dataLock);
 
-	activeThreads--;
+	size_t pair = 0;
+	for (uint b = second; b < lastSecond; b++)
+		for (uint a = first; a < std::min(lastFirst, b); a++) {
+
+			int index = linearize(a, b);
+			sums[index].add(local[pair++]);
+
+			state[index].progress = (float)sums[index].count / (float)total;
+
+			if ((local[pair - 1].count > 0) && (sums[index].count == total))
+				progress.finished();
+		}
 
 }
-*/
 
 
-/*
 // convert a pair of values into a linear index
 int Difference::linearize(uint x, uint y) {
 
-// the algorithm assumes y > x
-if (x > y)
-return linearize(y, x);
+	// the algorithm assumes y > x
+	if (x > y)
+		return linearize(y, x);
 
-// we don't compare an image to itself
-else if (x == y)
-return -1;
+	// we don't compare an image to itself
+	else if (x == y)
+		return -1;
 
-else
-return ((y*(y - 1)) >> 1) + x;
+	else
+		return ((y*(y - 1)) >> 1) + x;
 
 }
-*/
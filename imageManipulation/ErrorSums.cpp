@@ -0,0 +1,127 @@
+#include "global.h"
+
+
+// widen a row to floats for the kernels, noting its maximum on the way
+template <typename T>
+static const float* widen(Span<const T> in, vector<float>& scratch, float& max) {
+
+	float top = max;
+	for (size_t it = 0; it < in.size(); it++) {
+
+		float v = PixelTraits<T>::toFloat(in[it]);
+		scratch[it] = v;
+		top = (v > top) ? v : top;
+	}
+
+	max = top;
+	return scratch.data();
+
+}
+
+// floats need no copy, just the maximum
+static const float* widen(Span<const float> in, vector<float>&, float& max) {
+
+	float top = max;
+	for (size_t it = 0; it < in.size(); it++)
+		top = (in[it] > top) ? in[it] : top;
+
+	max = top;
+	return in.data();
+
+}
+
+// read each component of both views once, whatever they're stored as
+template <typename A, typename B>
+static void accumulate(ErrorSums& sums, const ImageView& first, const ImageView& second) {
+
+	size_t length = (size_t)first.width() * first.channels();
+	vector<float> scratchA(std::is_same<A, float>::value ? 0 : length);
+	vector<float> scratchB(std::is_same<B, float>::value ? 0 : length);
+
+	for (uint y = 0; y < first.height(); y++) {
+
+		const float* a = widen(first.rowAs<A>(y), scratchA, sums.max);
+		const float* b = widen(second.rowAs<B>(y), scratchB, sums.max);
+
+		differenceSums(a, b, length, sums.squared, sums.absolute);
+	}
+
+	sums.count += (ulong)first.pixels() * first.channels();
+
+}
+
+// both 8-bit? Then there's nothing to widen, and the sums can be exact
+template <>
+void accumulate<uchar, uchar>(ErrorSums& sums, const ImageView& first, const ImageView& second) {
+
+	size_t length = (size_t)first.width() * first.channels();
+	uchar top = 0;
+
+	for (uint y = 0; y < first.height(); y++)
+		differenceSums(first.rowAs<uchar>(y).data(), second.rowAs<uchar>(y).data(), length,
+			sums.squaredSteps, sums.absoluteSteps, top);
+
+	sums.max = std::max(sums.max, PixelTraits<uchar>::toFloat(top));
+	sums.count += (ulong)first.pixels() * first.channels();
+
+}
+
+void ErrorSums::add(const ImageView& first, const ImageView& second) {
+
+	dispatchFormat(first.format(), [&](auto a) {
+		dispatchFormat(second.format(), [&](auto b) {
+
+			accumulate<typename decltype(a)::type, typename decltype(b)::type>(
+				*this, first, second);
+		});
+	});
+
+}
+
+// handy for merging the work of several threads
+void ErrorSums::add(const ErrorSums& other) {
+
+	squared.add(other.squared);
+	absolute.add(other.absolute);
+	squaredSteps += other.squaredSteps;
+	absoluteSteps += other.absoluteSteps;
+	max = (other.max > max) ? other.max : max;
+	count += other.count;
+
+}
+
+// the exact sums are scaled just the once, so they stay reproducible
+double ErrorSums::squaredError() const {
+
+	return squared.value() + squaredSteps / (255.0 * 255.0);
+
+}
+
+double ErrorSums::absoluteError() const {
+
+	return absolute.value() + absoluteSteps / 255.0;
+
+}
+
+// the same formulas as the original calcMetrics
+DiffResult ErrorSums::result() const {
+
+	DiffResult results;
+	results.x = 0;
+	results.y = 0;
+	results.psnr = results.mae = results.rmse = numeric_limits<double>::quiet_NaN();
+
+	if (count == 0)
+		return results;
+
+	double total = 1.0 / (double)count;
+	results.mae = absoluteError() * total;
+
+	double temp = squaredError() * total;
+	results.psnr = 20.0 * log10((double)max) - 10.0 * log10(temp);
+	results.rmse = sqrt(temp);
+
+	results.progress = 1.0;			// we are done, after all
+	return results;
+
+}
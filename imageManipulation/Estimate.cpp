@@ -0,0 +1,213 @@
+#include "global.h"
+
+
+// strata a side, at most; each is a rectangle of the image
+static const uint strataSize = 16;
+
+// rows drawn from each stratum to begin with; it doubles from there
+static const uint firstSamples = 4;
+
+// standard errors either side of an estimate, for about 95% confidence
+static const double confidence = 1.959964;
+
+// one rectangle of the image, and what its sampled rows have said so far.
+//  Each row's mean error is one sample
+struct Stratum {
+
+	uint left = 0, top = 0;
+	uint width = 0, height = 0;
+	double weight = 0.0;		// its share of the image
+
+	ulong drawn = 0;
+	double squared = 0.0, squaredSquares = 0.0;	// sum and sum of squares
+	double absolute = 0.0, absoluteSquares = 0.0;
+
+};
+
+// the stratified mean of one error, and its standard error
+static void combine(const vector<Stratum>& strata, bool squared, double& mean, double& error) {
+
+	mean = 0.0;
+	double variance = 0.0;
+
+	for (const Stratum& stratum : strata) {
+
+		double n = (double)stratum.drawn;
+		double sum = squared ? stratum.squared : stratum.absolute;
+		double squares = squared ? stratum.squaredSquares : stratum.absoluteSquares;
+
+		mean += stratum.weight * sum / n;
+
+		double spread = std::max(0.0, (squares - sum * sum / n) / (n - 1.0));
+		variance += stratum.weight * stratum.weight * spread / n;
+	}
+
+	error = sqrt(variance);
+
+}
+
+static double psnrOf(double mse, float peak) {
+
+	return 20.0 * log10((double)peak) - 10.0 * log10(mse);
+
+}
+
+// the metrics, as best the strata can tell
+static DiffResult summarize(const vector<Stratum>& strata, float peak, double sampled) {
+
+	double squared, squaredError, absolute, absoluteError;
+	combine(strata, true, squared, squaredError);
+	combine(strata, false, absolute, absoluteError);
+
+	DiffResult out;
+	out.x = 0;
+	out.y = 0;
+	out.psnr = psnrOf(squared, peak);
+	out.rmse = sqrt(squared);
+	out.mae = absolute;
+
+	// the error can't be negative, whatever the spread says
+	double low = std::max(0.0, squared - confidence * squaredError);
+	double high = squared + confidence * squaredError;
+
+	out.psnrRange.low = psnrOf(high, peak);
+	out.psnrRange.high = psnrOf(low, peak);
+	out.rmseRange.low = sqrt(low);
+	out.rmseRange.high = sqrt(high);
+	out.maeRange.low = std::max(0.0, absolute - confidence * absoluteError);
+	out.maeRange.high = absolute + confidence * absoluteError;
+	out.sampled = sampled;
+
+	return out;
+
+}
+
+
+/* Cut the image into a grid of strata and draw whole rows of each at random,
+*  a few per stratum at first and twice as many every round after. Every row
+*  of a stratum is the same length, so its mean is a fair estimate of the
+*  stratum's, and weighting the strata by size gives the image's. The spread
+*  within each stratum gives the interval. The draw is seeded the same way
+*  every time, so the same pair always gets the same answer. */
+DiffResult Difference::estimate(const ImageView& first, const ImageView& second,
+	double tolerance, float peak, const function<void(const DiffResult&)>& step)
+{
+	if (!first.valid() || !second.valid() ||
+		(first.width() != second.width()) ||
+		(first.height() != second.height()) ||
+		(first.channels() != second.channels()))
+		return ErrorSums().result();
+
+	uint w = first.width();
+	uint h = first.height();
+	uchar c = first.channels();
+	ulong pixels = first.pixels();
+
+	uint across = std::min(strataSize, w);
+	uint down = std::min(strataSize, h);
+
+	vector<Stratum> strata;
+	for (uint gy = 0; gy < down; gy++)
+		for (uint gx = 0; gx < across; gx++) {
+
+			Stratum next;
+			next.left = (uint)(((ulong)w * gx) / across);
+			next.top = (uint)(((ulong)h * gy) / down);
+			next.width = (uint)(((ulong)w * (gx + 1)) / across) - next.left;
+			next.height = (uint)(((ulong)h * (gy + 1)) / down) - next.top;
+			next.weight = ((double)next.width * next.height) / pixels;
+			strata.push_back(next);
+		}
+
+	mt19937 random(0);
+	size_t bytes = c * (formatSize(first.format()) + formatSize(second.format()));
+	float top = -numeric_limits<float>::infinity();	// the largest we've seen
+	ulong read = 0;
+
+	for (ulong wanted = firstSamples; ; wanted *= 2) {
+
+		ulong reading = 0;
+		for (const Stratum& stratum : strata)
+			reading += (wanted - stratum.drawn) * stratum.width;
+
+		// by now a sample is no bargain, so just measure the lot
+		if (2 * (read + reading) > pixels) {
+
+			DiffResult out = measure(first, second);
+			out.psnrRange.low = out.psnrRange.high = out.psnr;
+			out.rmseRange.low = out.rmseRange.high = out.rmse;
+			out.maeRange.low = out.maeRange.high = out.mae;
+
+			progress.read((unsigned long long)pixels * bytes);
+			if (step)
+				step(out);
+			return out;
+		}
+
+		for (Stratum& stratum : strata) {
+
+			uniform_int_distribution<uint> row(stratum.top, stratum.top + stratum.height - 1);
+			double length = (double)stratum.width * c;
+
+			for (; stratum.drawn < wanted; stratum.drawn++) {
+
+				uint y = row(random);
+				ErrorSums sums;
+				sums.add(first.region(stratum.left, y, stratum.width, 1),
+					second.region(stratum.left, y, stratum.width, 1));
+
+				double squared = sums.squaredError() / length;
+				double absolute = sums.absoluteError() / length;
+				stratum.squared += squared;
+				stratum.squaredSquares += squared * squared;
+				stratum.absolute += absolute;
+				stratum.absoluteSquares += absolute * absolute;
+				top = std::max(top, sums.max);
+			}
+		}
+
+		read += reading;
+		progress.read((unsigned long long)reading * bytes);
+
+		DiffResult out = summarize(strata, isnan(peak) ? top : peak, (double)read / pixels);
+		if (step)
+			step(out);
+
+		// NaN won't get any better with more rows
+		if (isnan(out.psnr) || ((out.psnrRange.low >= out.psnr - tolerance) &&
+			(out.psnrRange.high <= out.psnr + tolerance)))
+			return out;
+	}
+
+}
+
+
+// every pair estimated; see comparePairs()
+int Difference::compareEstimated(const vector<string>& files, const char* output,
+	const CompareOptions& options)
+{
+	double tolerance = options.tolerance;
+
+	std::ostringstream mode;
+	mode << "estimating to within " << tolerance << "dB";
+
+	int status = comparePairs(files, output, options, mode.str().c_str(),
+		"PSNR [95% CI] / RMSE / MAE / SAMPLED",
+		[tolerance](const Image& a, const Image& b)
+		{
+			return estimate(a.view(), b.view(), tolerance, std::max(a.max(), b.max()));
+		},
+		[](ofstream& out, const DiffResult& result)
+		{
+			out << result.psnr << "dB [" << result.psnrRange.low << " - " <<
+				result.psnrRange.high << "] / " << result.rmse << " / " << result.mae <<
+				" / " << (100.0 * result.sampled) << "%";
+		});
+
+	ProgressSnapshot done = progress.snapshot();
+	cout << "* " << done.pairs << " pairs estimated, reading " <<
+		(int)((done.bytesTotal > 0) ? (100.0 * done.bytes) / done.bytesTotal : 0.0) <<
+		"% of what a full comparison would." << endl;
+
+	return status;
+}
@@ -2,14 +2,103 @@
 
 
 // good ol' constructor
-Image::Image(uint width, uint height, uchar components) {
+Image::Image(uint width, uint height, uchar components, PixelFormat format,
+	ImageLayout layout, ImagePool* pool, bool clear) {
 
 	w = width;
 	h = height;
 	c = components;
+	fmt = format;
+	compSize = formatSize(format);
+	order = layout;
 
-	for (uint it = 0; it < height; it++)
-		data.push_back(Scanline(w, c));
+	// work out how to walk through the storage. Every row is padded out
+	//  so the next one starts on a cache line
+	size_t count;
+	if (order == ImageLayout::PLANAR) {
+
+		stride = paddedStride(w, compSize, 1);
+		plane = stride * h;
+		count = plane * c;
+	}
+	else {
+
+		// whole pixels too, so GL can step over the padding
+		stride = paddedStride((size_t)w * c, compSize, c);
+		plane = 0;
+		count = stride * h;
+	}
+
+	// one aligned allocation for the lot, rather than one per pixel
+	if (pool)
+		buffer = pool->acquire(count * compSize);
+	else
+		buffer = alignedBuffer<uchar>(count * compSize);
+	origin = buffer.get();
+	cache = make_shared<StatsCache>();
+
+	// unset components are NaN, as before. Integers have no NaN, so zero
+	if (!clear)
+		return;
+	else if (fmt == PixelFormat::FLOAT32)
+		std::fill((float*)origin, (float*)origin + count, numeric_limits<float>::signaling_NaN());
+	else if (fmt == PixelFormat::FLOAT16)
+		std::fill((half*)origin, (half*)origin + count, half(numeric_limits<float>::quiet_NaN()));
+	else
+		memset(origin, 0, count * compSize);
+
+}
+
+// someone else filled the storage, so there's nothing to clear
+Image::Image(uint width, uint height, uchar components, PixelFormat format,
+	shared_ptr<uchar> storage) {
+
+	w = width;
+	h = height;
+	c = components;
+	fmt = format;
+	compSize = formatSize(format);
+	order = ImageLayout::INTERLEAVED;
+
+	stride = paddedStride((size_t)w * c, compSize, c);
+	plane = 0;
+
+	buffer = storage;
+	origin = buffer.get();
+	cache = make_shared<StatsCache>();
+
+}
+
+// take over a decoded buffer rather than hold two copies of every frame
+shared_ptr<Image> Image::from(const ImageView& view, ImagePool* pool) {
+
+	if (!view.valid())
+		return nullptr;
+
+	uint width = view.width();
+	uint height = view.height();
+	uchar components = view.channels();
+	PixelFormat format = view.format();
+
+	// STB allocates rowAlignment-aligned, so any width whose rows need no
+	//  padding can be adopted
+	size_t padded = paddedStride((size_t)width * components, formatSize(format), components);
+	if (view.storage() && view.aligned() && (view.rowStride() == padded))
+		return make_shared<Image>(width, height, components, format,
+			shared_ptr<uchar>(view.storage(), (uchar*)view.bytes()));
+
+	// every pixel gets written, so skip the fill
+	shared_ptr<Image> out = make_shared<Image>(width, height, components, format,
+		ImageLayout::INTERLEAVED, pool, false);
+	dispatchFormat(format, [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		for (uint y = 0; y < height; y++)
+			memcpy((void*)out->rowAs<T>(y).data(), (const void*)view.rowAs<T>(y).data(),
+				(size_t)width * components * sizeof(T));
+	});
+
+	return out;
 
 }
 
@@ -18,39 +107,232 @@ ulong Image::pixels() const { return w * h; }
 uint Image::width() const { return w; }
 uint Image::height() const { return h; }
 uchar Image::channels() const { return c; }
+PixelFormat Image::format() const { return fmt; }
+ImageLayout Image::layout() const { return order; }
+size_t Image::rowStride() const { return stride; }
+size_t Image::planeStride() const { return plane; }
+
+// the one place that knows every layout
+uchar* Image::at(uint x, uint y) const {
+
+	switch (order) {
+
+	case ImageLayout::PLANAR:
+		return origin + (y * stride + x) * compSize;
+
+	default:
+		return origin + (y * stride + (size_t)x * c) * compSize;
+	}
+
+}
+
+// where row y (of the given plane) starts, and how many components it holds
+uchar* Image::rowStart(uint y, uchar p, size_t& length) const {
+
+	assert((y < h) && ((p == 0) || ((order == ImageLayout::PLANAR) && (p < c))));
+
+	length = (order == ImageLayout::PLANAR) ? w : (size_t)w * c;
+	return origin + (p * plane + y * stride) * compSize;
+
+}
+
+const float* Image::data() const {
+
+	assert(fmt == PixelFormat::FLOAT32);
+	return (const float*)origin;
+
+}
+
+// we can't see writes through the raw pointer, so assume the worst
+float* Image::data() {
+
+	assert(fmt == PixelFormat::FLOAT32);
+	cache->clear();
+	return (float*)origin;
+
+}
+
+void Image::modified() { cache->clear(); }
+
+// convert count components, reading every step-th one of the source
+template <typename To, typename From>
+static void convertRun(To* out, const From* in, size_t count, size_t step) {
+
+	if (std::is_same<To, From>::value && (step == 1))
+		memcpy((void*)out, (const void*)in, count * sizeof(To));
+	else
+		for (size_t it = 0; it < count; it++)
+			out[it] = PixelTraits<To>::fromFloat(PixelTraits<From>::toFloat(in[it * step]));
+
+}
+
+// copy in a whole frame at once, converting as we go
+template <typename From>
+void Image::loadFrom(const From* in) {
+
+	size_t line = (size_t)w * c;
 
-// not so boring getter
+	dispatchFormat(fmt, [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		const From* src = in;
+
+		if (order == ImageLayout::PLANAR) {
+
+			for (uint y = 0; y < h; y++, src += line)
+				for (uint ch = 0; ch < c; ch++)
+					convertRun((T*)(origin + (ch * plane + y * stride) * compSize),
+						src + ch, w, c);
+		}
+		else
+			for (uint y = 0; y < h; y++, src += line)
+				convertRun((T*)(origin + y * stride * compSize), src, line, 1);
+	});
+
+	cache->clear();
+
+}
+
+void Image::load(const float* in) { loadFrom(in); }
+void Image::load(const uchar* in) { loadFrom(in); }
+
+// grind through the storage once, gathering everything
+ImageStats Image::computeStats() const {
+
+	ImageStats out;
+	out.min = numeric_limits<float>::quiet_NaN();
+	out.max = numeric_limits<float>::quiet_NaN();
+	out.histogram.fill(0);
+
+	float lo = numeric_limits<float>::infinity();
+	float hi = -numeric_limits<float>::infinity();
+	double sum = 0.0;
+	double squares = 0.0;
+
+	dispatchFormat(fmt, [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		forEachRun([&](const uchar* start, size_t length) {
+
+			const T* in = (const T*)start;
+
+			// branch-free, but the double sums have to go in order, so without
+			//  fast-math this stays scalar; it's one pass all the same. NaNs
+			//  fail every comparison
+			ulong valid = 0;
+			double rowSum = 0.0;
+			double rowSquares = 0.0;
+			for (size_t it = 0; it < length; it++) {
+
+				float v = PixelTraits<T>::toFloat(in[it]);
+				bool ok = (v == v);
+				lo = (v < lo) ? v : lo;
+				hi = (v > hi) ? v : hi;
+				rowSum += ok ? v : 0.0f;
+				rowSquares += ok ? (double)v * v : 0.0;
+				valid += ok;
+			}
+
+			// the histogram can't vectorize, but the run is still in cache
+			for (size_t it = 0; it < length; it++) {
+
+				float v = PixelTraits<T>::toFloat(in[it]);
+				if (v == v) {
+
+					int bin = (int)(v * ImageStats::bins);
+					bin = (bin < 0) ? 0 : (bin >= (int)ImageStats::bins) ? ImageStats::bins - 1 : bin;
+					out.histogram[bin]++;
+				}
+			}
+
+			out.count += valid;
+			sum += rowSum;
+			squares += rowSquares;
+		});
+	});
+
+	if (out.count > 0) {
+
+		out.min = lo;
+		out.max = hi;
+	}
+
+	out.mean = (out.count > 0) ? sum / out.count : 0.0;
+	out.sumSquares = squares;
+
+	return out;
+
+}
+
+shared_ptr<const ImageStats> Image::stats() const {
+
+	return cache->get([this]() { return computeStats(); });
+
+}
+
+// share our storage, if it can be described as a view
+ImageView Image::view() const {
+
+	if (order != ImageLayout::INTERLEAVED)
+		return ImageView();
+
+	return ImageView(origin, fmt, w, h, c, stride, buffer);
+
+}
+
+// same storage, same stride, just a different corner and size
+Image Image::region(uint x, uint y, uint width, uint height) {
+
+	if (((ulong)x + width > w) || ((ulong)y + height > h))
+		throw new out_of_range("Image: Region out of range");
+
+	Image out(*this);
+	out.w = width;
+	out.h = height;
+	out.origin = at(x, y);
+
+	// stats of the region are its own, but share our notion of a write
+	out.cache = make_shared<StatsCache>(cache->counter());
+
+	return out;
+
+}
+
+// a read-only Image hands out read-only regions, so the cast is safe
+const Image Image::region(uint x, uint y, uint width, uint height) const {
+
+	return const_cast<Image*>(this)->region(x, y, width, height);
+
+}
+
+// no longer a grind, unless the cache has gone stale
 float Image::max() const {
 
 	// height = 0? That ain't good
 	if (h == 0)
 		return numeric_limits<float>::signaling_NaN();
 
-	// otherwise, grind away
-	float max = data[0].max();
-	for (uint it = 1; it < h; it++)
-		if (data[it].max() > max)
-			max = data[it].max();
-
-	return max;
+	return stats()->max;
 
 }
 
 // handle accesses in a programmer-friendly way
-Scanline& Image::operator[](size_t index) {
+Scanline Image::operator[](size_t index) {
 
-	if (index >= data.size())
+	if (index >= h)
 		throw new out_of_range("Image: Scanline out of range");
+
+	// interleaved pixels sit c components apart, planar ones are adjacent
+	if (order == ImageLayout::PLANAR)
+		return Scanline(at(0, index), fmt, w, c, compSize, plane * compSize, cache.get());
 	else
-		return data[index];
+		return Scanline(at(0, index), fmt, w, c, c * compSize, compSize, cache.get());
 
 }
 
-const Scanline& Image::operator[](size_t index) const {
+// a read-only Image hands out read-only Scanlines, so the cast is safe
+const Scanline Image::operator[](size_t index) const {
 
-	if (index >= data.size())
-		throw new out_of_range("Image: Scanline out of range");
-	else
-		return data[index];
+	return const_cast<Image*>(this)->operator[](index);
 
 }
@@ -0,0 +1,107 @@
+#include "global.h"
+
+
+// nothing to do but set up the shared state
+ImagePool::ImagePool() { state = make_shared<State>(); }
+
+// outstanding buffers will find the pool closed, and free themselves. Both
+//  under the one lock, so nothing can come back between the two
+ImagePool::~ImagePool() {
+
+	std::lock_guard<mutex> guard(state->lock);
+	state->closed = true;
+
+	for (auto& list : state->idle)
+		for (uchar* p : list.second)
+			_aligned_free(p);
+
+	state->idle.clear();
+	state->stats.bytesIdle = 0;
+
+}
+
+// group nearby sizes together, a page at a time
+size_t ImagePool::sizeClass(size_t bytes) {
+
+	const size_t page = 4096;
+	return ((bytes + page - 1) / page) * page;
+
+}
+
+// recycle if we can, allocate if we must
+shared_ptr<uchar> ImagePool::acquire(size_t request) {
+
+	size_t bytes = sizeClass(request);
+	uchar* out = nullptr;
+
+	{
+		std::lock_guard<mutex> guard(state->lock);
+		PoolStats& stats = state->stats;
+
+		vector<uchar*>& list = state->idle[bytes];
+		if (!list.empty()) {
+
+			out = list.back();
+			list.pop_back();
+			stats.reuses++;
+			stats.bytesIdle -= bytes;
+		}
+		else
+			stats.allocations++;
+
+		stats.bytesInUse += bytes;
+		stats.highWater = std::max(stats.highWater, stats.bytesInUse);
+		stats.highWaterTotal = std::max(stats.highWaterTotal, stats.bytesInUse + stats.bytesIdle);
+	}
+
+	// allocate outside the lock
+	if (out == nullptr) {
+
+		out = static_cast<uchar*>(_aligned_malloc(bytes, rowAlignment));
+		if (out == nullptr)
+			throw std::bad_alloc();
+	}
+
+	// when the last user lets go, hand it back rather than freeing it
+	shared_ptr<State> home = state;
+	return shared_ptr<uchar>(out, [home, bytes](uchar* p) {
+
+		std::lock_guard<mutex> guard(home->lock);
+		home->stats.bytesInUse -= bytes;
+
+		if (home->closed)
+			_aligned_free(p);
+		else {
+
+			home->idle[bytes].push_back(p);
+			home->stats.bytesIdle += bytes;
+		}
+	});
+
+}
+
+// a copy, so the caller doesn't need the lock
+PoolStats ImagePool::stats() const {
+
+	std::lock_guard<mutex> guard(state->lock);
+	return state->stats;
+
+}
+
+// hand the idle buffers back to the system
+void ImagePool::trim() {
+
+	std::lock_guard<mutex> guard(state->lock);
+
+	for (auto& list : state->idle) {
+
+		for (uchar* p : list.second)
+			_aligned_free(p);
+
+		list.second.clear();
+	}
+
+	state->idle.clear();
+	state->stats.bytesIdle = 0;
+
+}
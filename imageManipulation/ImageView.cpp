@@ -0,0 +1,69 @@
+#include "global.h"
+
+#include "stb_image.h"
+
+
+// good ol' constructors
+ImageView::ImageView(const float* data, uint width, uint height, uchar channels,
+	size_t s, shared_ptr<const void> o) :
+	ImageView(data, PixelFormat::FLOAT32, width, height, channels, s, o) {}
+
+ImageView::ImageView(const void* data, PixelFormat format, uint width, uint height,
+	uchar channels, size_t s, shared_ptr<const void> o) {
+
+	origin = (const uchar*)data;
+	fmt = format;
+	w = width;
+	h = height;
+	c = channels;
+
+	// zero means tightly packed
+	stride = (s == 0) ? (size_t)w * c : s;
+	owner = o;
+
+}
+
+// let STB do the work, then take charge of its buffer
+ImageView ImageView::decode(const char* file, PixelFormat format) {
+
+	int width, height, channels;
+	void* pixels;
+
+	// STB decodes straight into three of our four formats
+	if (format == PixelFormat::UINT8)
+		pixels = stbi_load(file, &width, &height, &channels, 0);
+	else if (format == PixelFormat::UINT16)
+		pixels = stbi_load_16(file, &width, &height, &channels, 0);
+	else
+		pixels = stbi_loadf(file, &width, &height, &channels, 0);
+
+	// null return? ERROR
+	if (pixels == nullptr)
+		return ImageView();
+
+	shared_ptr<const void> owner(pixels, [](const void* p) { stbi_image_free((void*)p); });
+	if (format != PixelFormat::FLOAT16)
+		return ImageView(pixels, format, width, height, channels, 0, owner);
+
+	// halves we have to make ourselves; the floats go as soon as we're done
+	size_t count = (size_t)width * height * channels;
+	shared_ptr<half> out = alignedBuffer<half>(count);
+
+	const float* in = (const float*)pixels;
+	for (size_t it = 0; it < count; it++)
+		out.get()[it] = half(in[it]);
+
+	return ImageView(out.get(), format, width, height, channels, 0, out);
+
+}
+
+// carve out a smaller window onto the same storage
+ImageView ImageView::region(uint x, uint y, uint width, uint height) const {
+
+	if (!valid() || ((ulong)x + width > w) || ((ulong)y + height > h))
+		return ImageView();
+
+	return ImageView(origin + (y * stride + (size_t)x * c) * formatSize(fmt), fmt,
+		width, height, c, stride, owner);
+
+}
@@ -0,0 +1,44 @@
+#include "global.h"
+
+
+// nothing started yet
+JobProgress::JobProgress() : pairs(0), pairsTotal(0), bytes(0), bytesTotal(0),
+	started(steady_clock::now().time_since_epoch().count()) {}
+
+void JobProgress::begin() {
+
+	pairs = 0;
+	bytes = 0;
+	pairsTotal = 0;
+	bytesTotal = 0;
+	started = steady_clock::now().time_since_epoch().count();
+
+}
+
+// usually not known until the images have been looked at
+void JobProgress::expect(ulong pairCount, unsigned long long byteCount) {
+
+	pairsTotal = pairCount;
+	bytesTotal = byteCount;
+
+}
+
+// each counter is read once; they may be a moment apart, which is fine here
+ProgressSnapshot JobProgress::snapshot() const {
+
+	ProgressSnapshot out;
+	out.pairs = pairs.load(std::memory_order_relaxed);
+	out.pairsTotal = pairsTotal.load(std::memory_order_relaxed);
+	out.bytes = bytes.load(std::memory_order_relaxed);
+	out.bytesTotal = bytesTotal.load(std::memory_order_relaxed);
+
+	steady_clock::duration since(steady_clock::now().time_since_epoch().count() - started.load());
+	out.elapsed = duration_cast<seconds>(since).count();
+
+	// the bytes move far more smoothly than the pairs, so estimate from them
+	if ((out.bytes > 0) && (out.bytesTotal >= out.bytes))
+		out.eta = out.elapsed * (float)(out.bytesTotal - out.bytes) / (float)out.bytes;
+
+	return out;
+
+}
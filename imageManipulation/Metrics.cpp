@@ -0,0 +1,379 @@
+#include "global.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>		// __cpuid, _xgetbv
+#define TARGET(isa)		// MSVC hands out every intrinsic regardless
+#else
+#include <cpuid.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#include <immintrin.h>
+
+
+// how many components go into each block before it's folded into the totals.
+//  Small enough that the plain double sums inside a block lose nothing
+//  measurable, large enough that the folding costs nothing
+static const size_t blockSize = 2048;
+
+
+// ask the CPU, and the OS, what we're allowed to use
+static SimdLevel detectSimd() {
+
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int leaves = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false, avx512 = false;
+	if (leaves >= 7) {
+
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	// the OS must save the wider registers on a context switch, too
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymm = (xcr0 & 0x6) == 0x6;
+	bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+	if (avx512 && zmm)
+		return SimdLevel::AVX512;
+	if (avx && avx2 && fma && ymm)
+		return SimdLevel::AVX2;
+	if (sse2)
+		return SimdLevel::SSE2;
+	return SimdLevel::SCALAR;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SimdLevel::AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SimdLevel::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE2;
+	return SimdLevel::SCALAR;
+#endif
+
+}
+
+SimdLevel simdLevel() {
+
+	static const SimdLevel level = detectSimd();
+	return level;
+
+}
+
+
+// the reference, and the tail end of every other kernel
+static void blockScalar(const float* a, const float* b, size_t count,
+	double& squared, double& absolute) {
+
+	double sq = 0.0, ab = 0.0;
+	for (size_t it = 0; it < count; it++) {
+
+		double temp = (double)a[it] - (double)b[it];
+		sq += temp * temp;
+		ab += fabs(temp);
+	}
+
+	squared = sq;
+	absolute = ab;
+
+}
+
+// four floats at a time, widened to two pairs of doubles
+static void blockSSE2(const float* a, const float* b, size_t count,
+	double& squared, double& absolute) {
+
+	const __m128d mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+	__m128d sq0 = _mm_setzero_pd(), sq1 = _mm_setzero_pd();
+	__m128d ab0 = _mm_setzero_pd(), ab1 = _mm_setzero_pd();
+
+	size_t it = 0;
+	for (; it + 4 <= count; it += 4) {
+
+		__m128 va = _mm_loadu_ps(a + it);
+		__m128 vb = _mm_loadu_ps(b + it);
+
+		__m128d lo = _mm_sub_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb));
+		__m128d hi = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)),
+			_mm_cvtps_pd(_mm_movehl_ps(vb, vb)));
+
+		sq0 = _mm_add_pd(sq0, _mm_mul_pd(lo, lo));
+		sq1 = _mm_add_pd(sq1, _mm_mul_pd(hi, hi));
+		ab0 = _mm_add_pd(ab0, _mm_and_pd(lo, mask));
+		ab1 = _mm_add_pd(ab1, _mm_and_pd(hi, mask));
+	}
+
+	alignas(16) double lanes[2];
+	_mm_store_pd(lanes, _mm_add_pd(sq0, sq1));
+	double sq = lanes[0] + lanes[1];
+	_mm_store_pd(lanes, _mm_add_pd(ab0, ab1));
+	double ab = lanes[0] + lanes[1];
+
+	double tailSq, tailAb;
+	blockScalar(a + it, b + it, count - it, tailSq, tailAb);
+	squared = sq + tailSq;
+	absolute = ab + tailAb;
+
+}
+
+// eight floats at a time, widened to two quads of doubles
+TARGET("avx2,fma")
+static void blockAVX2(const float* a, const float* b, size_t count,
+	double& squared, double& absolute) {
+
+	const __m256d mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+	__m256d sq0 = _mm256_setzero_pd(), sq1 = _mm256_setzero_pd();
+	__m256d ab0 = _mm256_setzero_pd(), ab1 = _mm256_setzero_pd();
+
+	size_t it = 0;
+	for (; it + 8 <= count; it += 8) {
+
+		__m256 va = _mm256_loadu_ps(a + it);
+		__m256 vb = _mm256_loadu_ps(b + it);
+
+		__m256d lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(va)),
+			_mm256_cvtps_pd(_mm256_castps256_ps128(vb)));
+		__m256d hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(va, 1)),
+			_mm256_cvtps_pd(_mm256_extractf128_ps(vb, 1)));
+
+		sq0 = _mm256_fmadd_pd(lo, lo, sq0);
+		sq1 = _mm256_fmadd_pd(hi, hi, sq1);
+		ab0 = _mm256_add_pd(ab0, _mm256_and_pd(lo, mask));
+		ab1 = _mm256_add_pd(ab1, _mm256_and_pd(hi, mask));
+	}
+
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, _mm256_add_pd(sq0, sq1));
+	double sq = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	_mm256_store_pd(lanes, _mm256_add_pd(ab0, ab1));
+	double ab = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+	double tailSq, tailAb;
+	blockScalar(a + it, b + it, count - it, tailSq, tailAb);
+	squared = sq + tailSq;
+	absolute = ab + tailAb;
+
+}
+
+// sixteen floats at a time, widened to two octets of doubles
+TARGET("avx512f")
+static void blockAVX512(const float* a, const float* b, size_t count,
+	double& squared, double& absolute) {
+
+	const __m512i mask = _mm512_set1_epi64(0x7fffffffffffffffLL);
+	__m512d sq0 = _mm512_setzero_pd(), sq1 = _mm512_setzero_pd();
+	__m512d ab0 = _mm512_setzero_pd(), ab1 = _mm512_setzero_pd();
+
+	size_t it = 0;
+	for (; it + 16 <= count; it += 16) {
+
+		__m512d lo = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(a + it)),
+			_mm512_cvtps_pd(_mm256_loadu_ps(b + it)));
+		__m512d hi = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(a + it + 8)),
+			_mm512_cvtps_pd(_mm256_loadu_ps(b + it + 8)));
+
+		sq0 = _mm512_fmadd_pd(lo, lo, sq0);
+		sq1 = _mm512_fmadd_pd(hi, hi, sq1);
+		ab0 = _mm512_add_pd(ab0, _mm512_castsi512_pd(
+			_mm512_and_epi64(_mm512_castpd_si512(lo), mask)));
+		ab1 = _mm512_add_pd(ab1, _mm512_castsi512_pd(
+			_mm512_and_epi64(_mm512_castpd_si512(hi), mask)));
+	}
+
+	alignas(64) double lanes[8];
+	_mm512_store_pd(lanes, _mm512_add_pd(sq0, sq1));
+	double sq = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+		((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	_mm512_store_pd(lanes, _mm512_add_pd(ab0, ab1));
+	double ab = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+		((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+
+	double tailSq, tailAb;
+	blockScalar(a + it, b + it, count - it, tailSq, tailAb);
+	squared = sq + tailSq;
+	absolute = ab + tailAb;
+
+}
+
+
+// one block at a time through the chosen kernel, compensating between blocks
+void differenceSums(const float* a, const float* b, size_t count,
+	CompensatedSum& squared, CompensatedSum& absolute, SimdLevel level) {
+
+	if (level > simdLevel())
+		level = simdLevel();
+
+	void(*block)(const float*, const float*, size_t, double&, double&);
+	switch (level) {
+
+	case SimdLevel::AVX512:
+		block = blockAVX512;
+		break;
+	case SimdLevel::AVX2:
+		block = blockAVX2;
+		break;
+	case SimdLevel::SSE2:
+		block = blockSSE2;
+		break;
+	default:
+		block = blockScalar;
+		break;
+	}
+
+	for (size_t it = 0; it < count; it += blockSize) {
+
+		double sq, ab;
+		block(a + it, b + it, std::min(blockSize, count - it), sq, ab);
+		squared.add(sq);
+		absolute.add(ab);
+	}
+
+}
+
+
+// how many 8-bit components go into each call of a byte kernel. The squares
+//  pile up in 32-bit lanes, each of which takes at most 4 * 255^2 per step,
+//  so this stays well clear of overflow at either width
+static const size_t byteBlockSize = 65536;
+
+// the reference for bytes; integers, so the sums are exact
+static void bytesScalar(const uchar* a, const uchar* b, size_t count,
+	unsigned long long& squared, unsigned long long& absolute, uchar& max) {
+
+	unsigned long long sq = 0, ab = 0;
+	uchar top = max;
+	for (size_t it = 0; it < count; it++) {
+
+		int temp = (int)a[it] - (int)b[it];
+		sq += (unsigned)(temp * temp);
+		ab += (unsigned)((temp < 0) ? -temp : temp);
+		top = std::max(top, std::max(a[it], b[it]));
+	}
+
+	squared = sq;
+	absolute = ab;
+	max = top;
+
+}
+
+// sixteen bytes at a time. |a - b| is two saturating subtracts; psadbw sums
+//  it, and pmaddwd squares and pairs it up once widened to 16 bits
+static void bytesSSE2(const uchar* a, const uchar* b, size_t count,
+	unsigned long long& squared, unsigned long long& absolute, uchar& max) {
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sq = zero, ab = zero, top = zero;
+
+	size_t it = 0;
+	for (; it + 16 <= count; it += 16) {
+
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + it));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + it));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+
+		__m128i lo = _mm_unpacklo_epi8(diff, zero);
+		__m128i hi = _mm_unpackhi_epi8(diff, zero);
+		sq = _mm_add_epi32(sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+		ab = _mm_add_epi64(ab, _mm_sad_epu8(diff, zero));
+		top = _mm_max_epu8(top, _mm_max_epu8(va, vb));
+	}
+
+	alignas(16) unsigned int sqLanes[4];
+	alignas(16) unsigned long long abLanes[2];
+	alignas(16) uchar topLanes[16];
+	_mm_store_si128((__m128i*)sqLanes, sq);
+	_mm_store_si128((__m128i*)abLanes, ab);
+	_mm_store_si128((__m128i*)topLanes, top);
+
+	bytesScalar(a + it, b + it, count - it, squared, absolute, max);
+	squared += (unsigned long long)sqLanes[0] + sqLanes[1] + sqLanes[2] + sqLanes[3];
+	absolute += abLanes[0] + abLanes[1];
+	for (uchar lane : topLanes)
+		max = std::max(max, lane);
+
+}
+
+// thirty-two bytes at a time, likewise
+TARGET("avx2")
+static void bytesAVX2(const uchar* a, const uchar* b, size_t count,
+	unsigned long long& squared, unsigned long long& absolute, uchar& max) {
+
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i sq = zero, ab = zero, top = zero;
+
+	size_t it = 0;
+	for (; it + 32 <= count; it += 32) {
+
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + it));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + it));
+		__m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+
+		// unpacking works within each 128-bit half, which is fine for a sum
+		__m256i lo = _mm256_unpacklo_epi8(diff, zero);
+		__m256i hi = _mm256_unpackhi_epi8(diff, zero);
+		sq = _mm256_add_epi32(sq, _mm256_add_epi32(_mm256_madd_epi16(lo, lo),
+			_mm256_madd_epi16(hi, hi)));
+		ab = _mm256_add_epi64(ab, _mm256_sad_epu8(diff, zero));
+		top = _mm256_max_epu8(top, _mm256_max_epu8(va, vb));
+	}
+
+	alignas(32) unsigned int sqLanes[8];
+	alignas(32) unsigned long long abLanes[4];
+	alignas(32) uchar topLanes[32];
+	_mm256_store_si256((__m256i*)sqLanes, sq);
+	_mm256_store_si256((__m256i*)abLanes, ab);
+	_mm256_store_si256((__m256i*)topLanes, top);
+
+	bytesScalar(a + it, b + it, count - it, squared, absolute, max);
+	for (unsigned int lane : sqLanes)
+		squared += lane;
+	absolute += (abLanes[0] + abLanes[1]) + (abLanes[2] + abLanes[3]);
+	for (uchar lane : topLanes)
+		max = std::max(max, lane);
+
+}
+
+
+// exact, so every kernel (and every order of blocks) gives the same answer
+void differenceSums(const uchar* a, const uchar* b, size_t count,
+	unsigned long long& squared, unsigned long long& absolute, uchar& max, SimdLevel level) {
+
+	if (level > simdLevel())
+		level = simdLevel();
+
+	// byte-wise AVX-512 needs the BW extension, which we don't check for
+	void(*block)(const uchar*, const uchar*, size_t, unsigned long long&,
+		unsigned long long&, uchar&);
+	switch (level) {
+
+	case SimdLevel::AVX512:
+	case SimdLevel::AVX2:
+		block = bytesAVX2;
+		break;
+	case SimdLevel::SSE2:
+		block = bytesSSE2;
+		break;
+	default:
+		block = bytesScalar;
+		break;
+	}
+
+	for (size_t it = 0; it < count; it += byteBlockSize) {
+
+		unsigned long long sq, ab;
+		block(a + it, b + it, std::min(byteBlockSize, count - it), sq, ab, max);
+		squared += sq;
+		absolute += ab;
+	}
+
+}
@@ -1,14 +1,14 @@
 #include "global.h"
 
 // good ol' constructor
-Pixel::Pixel(uchar components) {
+Pixel::Pixel(uchar* first, PixelFormat format, uchar components, size_t s,
+	StatsCache* sc) {
 
-	c.reserve(components);
-
-	maxAll = numeric_limits<float>::signaling_NaN();
-
-	for (uchar it = 0; it < components; it++)
-		c.push_back(numeric_limits<float>::signaling_NaN());
+	c = first;
+	fmt = format;
+	n = components;
+	step = s;
+	cache = sc;
 
 }
 
@@ -16,7 +16,7 @@ Pixel::Pixel(uchar components) {
 ulong Pixel::pixels() const { return 1; }
 uint Pixel::width() const { return 1; }
 uint Pixel::height() const { return 1; }
-uchar Pixel::channels() const { return c.size(); }
+uchar Pixel::channels() const { return n; }
 float Pixel::r() const { return get(0); }
 float Pixel::g() const { return get(1); }
 float Pixel::b() const { return get(2); }
@@ -24,34 +24,42 @@ bool Pixel::r(const float& v) { return set(0, v); }
 bool Pixel::g(const float& v) { return set(1, v); }
 bool Pixel::b(const float& v) { return set(2, v); }
 
-// now boring getter
-float Pixel::max() const { return maxAll; }
+// not so boring getter, as we no longer cache this
+float Pixel::max() const {
+
+	float max = numeric_limits<float>::quiet_NaN();
+	for (uchar it = 0; it < n; it++) {
+
+		float temp = readComponent(c + it * step, fmt);
+		if (isnan(max) || (temp > max))
+			max = temp;
+	}
+
+	return max;
+
+}
 
 // less boring getter/setters
 float Pixel::get(const uchar i) const {
 
-	if (i >= c.size())
+	if (i >= n)
 		throw new out_of_range("Pixel: Requested non-existant component");
 	else
-		return c[i];
+		return readComponent(c + i * step, fmt);
 
 }
 
 bool Pixel::set(const uchar i, const float& v) {
 
-	// the first part is easy
-	if ((i >= c.size()) || isnan(v))
+	// the only part left is easy; integer formats clamp on the way in
+	if ((i >= n) || isnan(v))
 		return false;
-	else {
 
-		c[i] = v;
+	writeComponent(c + i * step, fmt, v);
 
-		// did we break our maximum? 
-		if (isnan(maxAll) || (v > maxAll))
-
-			// then update
-			maxAll = v;
-	}
+	// the stats are recomputed on demand, rather than tracked here
+	if (cache)
+		cache->clear();
 
 	return true;
 }
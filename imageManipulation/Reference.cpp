@@ -0,0 +1,140 @@
+#include "global.h"
+
+
+/* One reference against every file. The reference is decoded once, in the
+*  format we compare in, and locked into memory, since every candidate reads
+*  all of it. The candidates go through the pool no more than decodeWindow at
+*  a time, each decoded and compared on the same worker while it's still warm
+*  and then dropped, so however many there are, only the reference and a
+*  window of candidates are ever held. Each result is written out (and
+*  flushed) as soon as it's in, in whatever order they finish. */
+int Difference::compareReference(const vector<string>& files, const char* output,
+	const CompareOptions& options)
+{
+	uint count = (uint)files.size();
+	if (count < 1)
+	{
+		cerr << endl << "* ERROR: you must supply at least one image to compare with the reference." <<
+			endl;
+		return -1;
+	}
+
+	// each candidate's buffer goes back to the job's pool once it's compared,
+	//  ready for the next
+	Job job(options, 0);
+	ThreadPool& pool = job.pool;
+	ImagePool& buffers = job.buffers;
+	PixelFormat format = job.format;
+	DecodeCache* source = job.cache.get();
+	job.announce("Comparing " + std::to_string(count) + " images against \"" +
+		options.reference + "\"");
+
+	if (options.stream || !options.store.empty() || (options.radius >= 0))
+		cout << "* Only the cache and SSIM apply against a reference; streaming, the store and "
+			"the radius don't." << endl;
+
+	bool similar = options.similarity && !options.exact;
+	if (options.similarity && options.exact)
+		cout << "* SSIM needs float images, so it's skipped in exact mode." << endl;
+
+	// no point decoding anything if the results have nowhere to go
+	ofstream out(output);
+	if (!out)
+	{
+		cerr << endl << "* ERROR: Could not write \"" << output << "\"." << endl;
+		return -1;
+	}
+
+	out << "candidate,file,PSNR (dB),RMSE,MAE" << (similar ? ",SSIM,MS-SSIM" : "") <<
+		"\n" << std::flush;
+
+	shared_ptr<Image> reference = loadImage(options.reference.c_str(), source, format);
+	if (reference == nullptr)
+		return -1;
+
+	// the working set has to grow to take it, or the lock will fail
+	void* base = (void*)reference->view().bytes();
+	size_t bytes = reference->rowStride() * reference->height() * formatSize(format);
+	HANDLE process = GetCurrentProcess();
+	SIZE_T low = 0, high = 0;
+	bool pinned = GetProcessWorkingSetSize(process, &low, &high) &&
+		SetProcessWorkingSetSize(process, low + bytes, high + bytes) &&
+		VirtualLock(base, bytes);
+	if (!pinned)
+		cout << "* Couldn't lock the reference into memory; carrying on without." << endl;
+
+	ImageView target = reference->view();
+	ulong total = reference->pixels() * reference->channels();
+	progress.expect(count, (unsigned long long)count * 2 * total * formatSize(format));
+
+	mutex writing;
+	vector<future<bool>> jobs(count);
+	uint submitted = 0;
+	bool complete = true;
+
+	for (uint it = 0; it < count; it++)
+	{
+		for (; submitted < std::min(count, it + decodeWindow); submitted++)
+		{
+			uint next = submitted;
+			jobs[next] = pool.async([&files, &target, &out, &writing, &buffers, next, source,
+				format, total, similar]()
+			{
+				shared_ptr<Image> candidate = loadImage(files[next].c_str(), source, format, &buffers);
+				bool fits = (candidate != nullptr) && (candidate->width() == target.width()) &&
+					(candidate->height() == target.height()) &&
+					(candidate->channels() == target.channels());
+
+				if ((candidate != nullptr) && !fits)
+					cerr << endl << "* ERROR: Image \"" << files[next] <<
+						"\" doesn't have the expected size." << endl;
+
+				// anything we couldn't use comes out as NaN, as in the matrix
+				DiffResult result = ErrorSums().result();
+				if (fits)
+				{
+					result = measure(target, candidate->view());
+					progress.read((unsigned long long)2 * total * formatSize(format));
+
+					if (similar)
+					{
+						Similarity found = similarity(target, candidate->view(), nullptr, &buffers);
+						result.ssim = found.ssim;
+						result.msssim = found.msssim;
+					}
+				}
+				progress.finished();
+
+				std::lock_guard<mutex> guard(writing);
+				out << next << ",\"" << files[next] << "\"," << result.psnr << "," <<
+					result.rmse << "," << result.mae;
+				if (similar)
+					out << "," << result.ssim << "," << result.msssim;
+				out << "\n" << std::flush;
+
+				return fits;
+			});
+		}
+
+		complete = collect(jobs[it]) && complete;
+	}
+	drain(pool);
+
+	if (pinned)
+	{
+		VirtualUnlock(base, bytes);
+		SetProcessWorkingSetSize(process, low, high);
+	}
+
+	job.report();
+
+	if (!out)
+	{
+		cerr << endl << "* ERROR: Could not write \"" << output << "\"." << endl;
+		return -1;
+	}
+
+	cout << "* Wrote \"" << output << "\"." << endl;
+
+	return complete ? 0 : -1;
+}
@@ -0,0 +1,129 @@
+#include "global.h"
+
+
+const char ResultStore::magic[8] = { 'G', 'F', 'X', 'R', 'E', 'S', '1', 0 };
+
+bool ResultStore::Key::operator<(const Key& other) const {
+
+	if (first != other.first)
+		return first < other.first;
+	if (second != other.second)
+		return second < other.second;
+	return fmt < other.fmt;
+
+}
+
+// the pair is unordered, so the key shouldn't be
+ResultStore::Key ResultStore::keyFor(unsigned long long a, unsigned long long b,
+	PixelFormat format) {
+
+	Key out;
+	out.first = std::min(a, b);
+	out.second = std::max(a, b);
+	out.fmt = format;
+	return out;
+
+}
+
+// a missing or unreadable file is just an empty store
+ResultStore::ResultStore(const string& file) : path(file) {
+
+	ifstream in(path, std::ios::binary);
+	if (!in)
+		return;
+
+	char check[sizeof(magic)];
+	unsigned long long count = 0;
+	in.read(check, sizeof(check));
+	in.read((char*)&count, sizeof(count));
+
+	if (!in || (memcmp(check, magic, sizeof(magic)) != 0))
+	{
+		cerr << endl << "* ERROR: \"" << path << "\" isn't a result store; starting afresh." << endl;
+		return;
+	}
+
+	for (unsigned long long it = 0; it < count; it++)
+	{
+		Record record;
+		if (!in.read((char*)&record, sizeof(Record)))
+			break;		// keep what we could read
+
+		DiffResult result;
+		result.x = result.y = 0;
+		result.progress = 1.0;
+		result.psnr = record.psnr;
+		result.rmse = record.rmse;
+		result.mae = record.mae;
+		result.ssim = record.ssim;
+		result.msssim = record.msssim;
+		results[record.key] = result;
+	}
+
+}
+
+bool ResultStore::find(unsigned long long a, unsigned long long b, PixelFormat format,
+	DiffResult& out) const {
+
+	auto found = results.find(keyFor(a, b, format));
+	if (found == results.end())
+		return false;
+
+	out = found->second;
+	return true;
+
+}
+
+void ResultStore::put(unsigned long long a, unsigned long long b, PixelFormat format,
+	const DiffResult& result) {
+
+	results[keyFor(a, b, format)] = result;
+	changed = true;
+
+}
+
+// written beside the old store and renamed over it, so a crash part way
+//  through loses this run's results rather than every run's
+bool ResultStore::save() {
+
+	if (!changed)
+		return true;
+
+	string temp = path + ".tmp";
+	{
+		ofstream out(temp, std::ios::binary);
+		unsigned long long count = results.size();
+		out.write(magic, sizeof(magic));
+		out.write((const char*)&count, sizeof(count));
+
+		for (const auto& entry : results)
+		{
+			Record record;
+			memset((void*)&record, 0, sizeof(Record));	// no stray bytes in the padding
+			record.key = entry.first;
+			record.psnr = entry.second.psnr;
+			record.rmse = entry.second.rmse;
+			record.mae = entry.second.mae;
+			record.ssim = entry.second.ssim;
+			record.msssim = entry.second.msssim;
+			out.write((const char*)&record, sizeof(Record));
+		}
+
+		if (!out)
+		{
+			out.close();
+			std::remove(temp.c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		std::remove(temp.c_str());
+		return false;
+	}
+
+	changed = false;
+	return true;
+
+}
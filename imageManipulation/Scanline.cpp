@@ -2,13 +2,17 @@
 
 
 // good ol' constructor
-Scanline::Scanline(uint width, uchar components) {
+Scanline::Scanline(uchar* row, PixelFormat format, uint width, uchar components,
+	size_t ps, size_t cs, StatsCache* sc) {
 
+	data = row;
+	fmt = format;
 	w = width;
 	c = components;
 
-	for (uint it = 0; it < width; it++)
-		data.push_back(Pixel(c));
+	pixelStep = ps;
+	chanStep = cs;
+	cache = sc;
 
 }
 
@@ -27,30 +31,34 @@ float Scanline::max() const {
 
 
 	// grind through it all
-	float max = data[0].max();
-	for (uint it = 1; it < w; it++)
-		if (data[it].max() > max)
-			max = data[it].max();
+	float max = (*this)[0].max();
+	for (uint it = 1; it < w; it++) {
 
-	return max;	// don't update maxAll!
+		float temp = (*this)[it].max();
+		if (isnan(max) || (temp > max))
+			max = temp;
+	}
+
+	return max;
 
 }
 
 // make this easy on programmers
-Pixel& Scanline::operator[](size_t index) {
+Pixel Scanline::operator[](size_t index) {
 
-	if (index >= data.size())
+	if (index >= w)
 		throw new out_of_range("Scanline: Pixel out of range");
 	else
-		return data[index];
+		return Pixel(data + index * pixelStep, fmt, c, chanStep, cache);
 
 }
 
-const Pixel& Scanline::operator[](size_t index) const {
+// a read-only Scanline hands out read-only Pixels
+const Pixel Scanline::operator[](size_t index) const {
 
-	if (index >= data.size())
+	if (index >= w)
 		throw new out_of_range("Scanline: Pixel out of range");
 	else
-		return data[index];
+		return Pixel(data + index * pixelStep, fmt, c, chanStep);
 
 }
@@ -0,0 +1,188 @@
+#include "global.h"
+
+
+// the grid the hash is taken from
+static const uint phashSize = 32;	// luma is averaged down to this square
+static const uint phashTerms = 9;	//  and this many DCT terms a side are kept
+
+// Rec. 601 weights; anything without three channels just uses the first
+template <uchar C, typename T>
+static float lumaOf(const T* pixel) {
+
+	if (C < 3)
+		return PixelTraits<T>::toFloat(pixel[0]);
+
+	return 0.299f * PixelTraits<T>::toFloat(pixel[0]) +
+		0.587f * PixelTraits<T>::toFloat(pixel[1]) +
+		0.114f * PixelTraits<T>::toFloat(pixel[2]);
+
+}
+
+// one bit per cell, set if it's above the threshold
+template <typename Test>
+static unsigned long long bitsOf(uint count, Test test) {
+
+	unsigned long long out = 0;
+	for (uint it = 0; it < count; it++)
+		if (test(it))
+			out |= 1ull << it;
+
+	return out;
+
+}
+
+// box-average the luma into the grid, then hash it
+Signature Signature::of(const ImageView& view) {
+
+	Signature out;
+	if (!view.valid() || (view.width() == 0) || (view.height() == 0))
+		return out;
+
+	vector<double> fine(phashSize * phashSize, 0.0);
+	vector<uint> fineCount(fine.size(), 0);
+
+	uint w = view.width();
+	uint h = view.height();
+
+	// with the format and channel count both fixed, the luma is a straight
+	//  line of loads and multiplies
+	bool known = true;
+	dispatchFormat(view.format(), [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		known = dispatchChannels(view.channels(), [&](auto channels) {
+
+			const uchar C = decltype(channels)::value;
+			for (uint y = 0; y < h; y++) {
+
+				const T* row = view.rowAs<T>(y).data();
+				uint fy = (uint)(((ulong)y * phashSize) / h);
+
+				for (uint x = 0; x < w; x++) {
+
+					float v = lumaOf<C>(row + (size_t)x * C);
+					if (v != v)
+						continue;	// NaNs would poison the whole cell
+
+					uint f = fy * phashSize + (uint)(((ulong)x * phashSize) / w);
+					fine[f] += v;
+					fineCount[f]++;
+				}
+			}
+		});
+	});
+	if (!known)
+		return out;
+
+	// images smaller than the grid leave cells empty; they count as black
+	for (size_t it = 0; it < fine.size(); it++)
+		fine[it] = (fineCount[it] > 0) ? fine[it] / fineCount[it] : 0.0;
+
+	// pHash: a separable DCT-II, but only the low terms we keep
+	vector<double> basis(phashTerms * phashSize);
+	for (uint u = 0; u < phashTerms; u++)
+		for (uint x = 0; x < phashSize; x++)
+			basis[u * phashSize + x] = cos(3.14159265358979323846 * (2 * x + 1) * u / (2.0 * phashSize));
+
+	vector<double> rows(phashSize * phashTerms, 0.0);	// each row, transformed
+	for (uint y = 0; y < phashSize; y++)
+		for (uint u = 0; u < phashTerms; u++) {
+
+			double sum = 0.0;
+			for (uint x = 0; x < phashSize; x++)
+				sum += basis[u * phashSize + x] * fine[y * phashSize + x];
+			rows[y * phashTerms + u] = sum;
+		}
+
+	// then down the columns, skipping the first term each way; those only
+	//  say how bright the image is overall, not what's in it
+	array<double, 64> terms;
+	for (uint v = 1; v < phashTerms; v++)
+		for (uint u = 1; u < phashTerms; u++) {
+
+			double sum = 0.0;
+			for (uint y = 0; y < phashSize; y++)
+				sum += basis[v * phashSize + y] * rows[y * phashTerms + u];
+			terms[(v - 1) * (phashTerms - 1) + (u - 1)] = sum;
+		}
+
+	array<double, 64> sorted = terms;
+	std::nth_element(sorted.begin(), sorted.begin() + 32, sorted.end());
+	double median = sorted[32];
+
+	out.phash = bitsOf(64, [&](uint it) { return terms[it] > median; });
+	out.valid = true;
+
+	return out;
+
+}
+
+
+// the first hash is the root; everything else hangs off it by distance
+void SignatureIndex::insert(unsigned long long hash, uint id) {
+
+	Node next;
+	next.hash = hash;
+	next.id = id;
+	nodes.push_back(next);
+
+	uint added = (uint)nodes.size() - 1;
+	if (added == 0)
+		return;
+
+	uint at = 0;
+	while (true) {
+
+		uint d = Signature::distance(hash, nodes[at].hash);
+		auto child = nodes[at].children.find(d);
+		if (child == nodes[at].children.end()) {
+
+			nodes[at].children[d] = added;
+			return;
+		}
+
+		at = child->second;
+	}
+
+}
+
+// only the children within radius of our distance to a node can hold a match
+vector<uint> SignatureIndex::query(unsigned long long hash, uint radius) const {
+
+	vector<uint> out;
+	if (nodes.empty())
+		return out;
+
+	vector<uint> todo(1, 0);
+	while (!todo.empty()) {
+
+		const Node& node = nodes[todo.back()];
+		todo.pop_back();
+
+		uint d = Signature::distance(hash, node.hash);
+		if (d <= radius)
+			out.push_back(node.id);
+
+		uint low = (d > radius) ? d - radius : 0;
+		for (auto child = node.children.lower_bound(low);
+			(child != node.children.end()) && (child->first <= d + radius); child++)
+			todo.push_back(child->second);
+	}
+
+	return out;
+
+}
+
+// one query per hash; each pair turns up twice, so keep it once
+vector<pair<uint, uint>> SignatureIndex::pairs(uint radius) const {
+
+	vector<pair<uint, uint>> out;
+	for (const Node& node : nodes)
+		for (uint other : query(node.hash, radius))
+			if (node.id < other)
+				out.push_back(pair<uint, uint>(node.id, other));
+
+	std::sort(out.begin(), out.end());
+	return out;
+
+}
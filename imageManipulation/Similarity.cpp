@@ -0,0 +1,281 @@
+#include "global.h"
+
+
+// the usual constants, for components that run from 0 to 1
+static const float C1 = 0.01f * 0.01f;
+static const float C2 = 0.03f * 0.03f;
+
+static const uint taps = 11;		// the window is taps x taps
+static const uint bandRows = 64;	// output rows per task
+
+// the MS-SSIM weights of Wang et al., finest scale first
+static const double scaleWeights[] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+static const uint maxScales = 5;
+
+
+// an 11-tap Gaussian with a sigma of 1.5, normalized to sum to one
+static const array<float, taps>& gaussian() {
+
+	static const array<float, taps> weights = []() {
+
+		array<float, taps> out;
+		double total = 0.0;
+		for (uint it = 0; it < taps; it++) {
+
+			double d = (double)it - (taps - 1) / 2;
+			out[it] = (float)exp(-(d * d) / (2.0 * 1.5 * 1.5));
+			total += out[it];
+		}
+
+		for (float& weight : out)
+			weight = (float)(weight / total);
+		return out;
+	}();
+
+	return weights;
+
+}
+
+// the SSIM map, and its contrast-structure half, summed
+struct SimilaritySums {
+
+	double ssim = 0.0;
+	double cs = 0.0;
+	ulong count = 0;
+
+	void add(const SimilaritySums& other) {
+
+		ssim += other.ssim;
+		cs += other.cs;
+		count += other.count;
+	}
+};
+
+/* Sum the SSIM map over output rows [top, bottom). Windows never hang off the
+*  edge, so output row r covers input rows r to r + 10. The Gaussian is
+*  separable: each input row is filtered horizontally once, into contiguous
+*  rows the compiler can vectorize, then each output row is a weighted sum
+*  of eleven of those. C is the channel count, so pulling a channel out of
+*  the interleaved rows is a constant stride. */
+template <uchar C>
+static SimilaritySums similarityBand(const ImageView& a, const ImageView& b,
+	uint top, uint bottom) {
+
+	const array<float, taps>& g = gaussian();
+	uint w = a.width();
+	uint outW = w - (taps - 1);
+	uint rows = bottom - top + (taps - 1);
+
+	// x, y, x^2, y^2 and xy, filtered horizontally, for every row we need
+	vector<float> filtered(5 * (size_t)rows * outW);
+	auto plane = [&](uint which, uint row) { return &filtered[((size_t)which * rows + row) * outW]; };
+
+	vector<float> inX(w), inY(w);
+	vector<float> mx(outW), my(outW), sxx(outW), syy(outW), sxy(outW);
+
+	SimilaritySums out;
+	for (uchar ch = 0; ch < C; ch++) {
+
+		for (uint r = 0; r < rows; r++) {
+
+			// pull one channel out of the interleaved rows
+			Span<const float> rowA = a.row(top + r);
+			Span<const float> rowB = b.row(top + r);
+			for (uint x = 0; x < w; x++) {
+
+				inX[x] = rowA[(size_t)x * C + ch];
+				inY[x] = rowB[(size_t)x * C + ch];
+			}
+
+			float* fx = plane(0, r);
+			float* fy = plane(1, r);
+			float* fxx = plane(2, r);
+			float* fyy = plane(3, r);
+			float* fxy = plane(4, r);
+			for (uint q = 0; q < 5; q++)
+				std::fill(plane(q, r), plane(q, r) + outW, 0.0f);
+
+			for (uint k = 0; k < taps; k++) {
+
+				float gk = g[k];
+				const float* u = inX.data() + k;
+				const float* v = inY.data() + k;
+				for (uint i = 0; i < outW; i++) {
+
+					fx[i] += gk * u[i];
+					fy[i] += gk * v[i];
+					fxx[i] += gk * u[i] * u[i];
+					fyy[i] += gk * v[i] * v[i];
+					fxy[i] += gk * u[i] * v[i];
+				}
+			}
+		}
+
+		// now down the columns, one output row at a time
+		for (uint r = 0; r < bottom - top; r++) {
+
+			std::fill(mx.begin(), mx.end(), 0.0f);
+			std::fill(my.begin(), my.end(), 0.0f);
+			std::fill(sxx.begin(), sxx.end(), 0.0f);
+			std::fill(syy.begin(), syy.end(), 0.0f);
+			std::fill(sxy.begin(), sxy.end(), 0.0f);
+
+			for (uint k = 0; k < taps; k++) {
+
+				float gk = g[k];
+				const float* fx = plane(0, r + k);
+				const float* fy = plane(1, r + k);
+				const float* fxx = plane(2, r + k);
+				const float* fyy = plane(3, r + k);
+				const float* fxy = plane(4, r + k);
+				for (uint i = 0; i < outW; i++) {
+
+					mx[i] += gk * fx[i];
+					my[i] += gk * fy[i];
+					sxx[i] += gk * fxx[i];
+					syy[i] += gk * fyy[i];
+					sxy[i] += gk * fxy[i];
+				}
+			}
+
+			double rowSsim = 0.0, rowCs = 0.0;
+			for (uint i = 0; i < outW; i++) {
+
+				float mxy = mx[i] * my[i];
+				float mxx = mx[i] * mx[i];
+				float myy = my[i] * my[i];
+
+				float cs = (2.0f * (sxy[i] - mxy) + C2) / ((sxx[i] - mxx) + (syy[i] - myy) + C2);
+				float l = (2.0f * mxy + C1) / (mxx + myy + C1);
+
+				rowSsim += l * cs;
+				rowCs += cs;
+			}
+
+			out.ssim += rowSsim;
+			out.cs += rowCs;
+		}
+	}
+
+	out.count = (ulong)(bottom - top) * outW * C;
+	return out;
+
+}
+
+// one scale, in bands; spread across the pool if we were given one
+template <uchar C>
+static SimilaritySums similarityScale(const ImageView& a, const ImageView& b, ThreadPool* pool) {
+
+	uint outH = a.height() - (taps - 1);
+	SimilaritySums out;
+
+	if (pool == nullptr) {
+
+		for (uint top = 0; top < outH; top += bandRows)
+			out.add(similarityBand<C>(a, b, top, std::min(outH, top + bandRows)));
+		return out;
+	}
+
+	vector<future<SimilaritySums>> bands;
+	for (uint top = 0; top < outH; top += bandRows) {
+
+		uint bottom = std::min(outH, top + bandRows);
+		bands.push_back(pool->async([&a, &b, top, bottom]() {
+			return similarityBand<C>(a, b, top, bottom); }));
+	}
+
+	// in band order, so the result doesn't depend on the timing
+	for (future<SimilaritySums>& band : bands)
+		out.add(band.get());
+	return out;
+
+}
+
+// average each 2x2 block, for the next scale down; every pixel is written
+template <uchar C>
+static TypedImage<float, C> halve(const ImageView& in, ImagePool* buffers) {
+
+	uint w = in.width() / 2;
+	uint h = in.height() / 2;
+	TypedImage<float, C> out(w, h, buffers);
+
+	for (uint y = 0; y < h; y++) {
+
+		Span<const float> top = in.row(2 * y);
+		Span<const float> bottom = in.row(2 * y + 1);
+		Span<float> dst = out.row(y);
+
+		for (uint x = 0; x < w; x++)
+			for (uchar ch = 0; ch < C; ch++) {
+
+				size_t left = (size_t)(2 * x) * C + ch;
+				size_t right = left + C;
+				dst[(size_t)x * C + ch] = 0.25f * (top[left] + top[right] + bottom[left] + bottom[right]);
+			}
+	}
+
+	return out;
+
+}
+
+
+// SSIM at full resolution, then MS-SSIM over as many scales as fit
+Similarity Difference::similarity(const ImageView& first, const ImageView& second,
+	ThreadPool* pool, ImagePool* buffers) {
+
+	Similarity out;
+
+	// float views of the same shape, big enough for at least one window
+	if (!first.valid() || !second.valid() ||
+		(first.format() != PixelFormat::FLOAT32) || (second.format() != PixelFormat::FLOAT32) ||
+		(first.width() != second.width()) || (first.height() != second.height()) ||
+		(first.channels() != second.channels()) ||
+		(first.width() < taps) || (first.height() < taps))
+		return out;
+
+	// small images get fewer scales, with the weights renormalized to suit
+	uint scales = 1;
+	while ((scales < maxScales) &&
+		(std::min(first.width(), first.height()) >> scales) >= taps)
+		scales++;
+
+	double weightTotal = 0.0;
+	for (uint it = 0; it < scales; it++)
+		weightTotal += scaleWeights[it];
+
+	// the channel count is fixed from here down, so the channel loops unroll
+	dispatchChannels(first.channels(), [&](auto channels) {
+
+		const uchar C = decltype(channels)::value;
+
+		// views of the smaller scales share (and so keep alive) their storage
+		ImageView a = first, b = second;
+		double product = 1.0;
+
+		for (uint scale = 0; scale < scales; scale++) {
+
+			if (scale > 0) {
+
+				a = halve<C>(a, buffers).view();
+				b = halve<C>(b, buffers).view();
+			}
+
+			SimilaritySums sums = similarityScale<C>(a, b, pool);
+			double ssim = sums.ssim / sums.count;
+			double cs = sums.cs / sums.count;
+
+			if (scale == 0)
+				out.ssim = ssim;
+
+			// negative similarity has no fractional power, so call it zero
+			double weight = scaleWeights[scale] / weightTotal;
+			double term = (scale + 1 == scales) ? ssim : cs;
+			product *= pow(std::max(term, 0.0), weight);
+		}
+
+		out.msssim = product;
+	});
+
+	return out;
+
+}
@@ -61,7 +61,7 @@ bool SimpleTexture::load() {
 }
 
 // stuff some values into the texture
-bool SimpleTexture::load(vector<float> data) {
+bool SimpleTexture::load(const vector<float>& data) {
 
 	if (hasStorage || (perPixelChan == 0))		// if allocated or invalid, throw an error
 		return false;
@@ -105,6 +105,94 @@ bool SimpleTexture::load(vector<float> data) {
 
 }
 
+// upload straight out of a view, no copies. Optionally flip vertically
+bool SimpleTexture::load(const ImageView& view, bool flip) {
+
+	if (hasStorage || (perPixelChan == 0))		// if allocated or invalid, throw an error
+		return false;
+
+	if (!view.valid() || (view.width() != width) || (view.height() != height) ||
+		(view.channels() != perPixelChan))
+		return false;
+
+	// determine the proper format
+	GLenum components;
+	switch (perPixelChan) {
+
+	case 1:
+		components = GL_RED;
+		break;
+	case 3:
+		components = GL_RGB;
+		break;
+	case 4:
+		components = GL_RGBA;
+		break;
+	default:
+		return false;
+	}
+
+	// and the matching type; GL converts to the internal format itself
+	GLenum pixelType;
+	switch (view.format()) {
+
+	case PixelFormat::FLOAT16:
+		pixelType = GL_HALF_FLOAT;
+		break;
+	case PixelFormat::UINT16:
+		pixelType = GL_UNSIGNED_SHORT;
+		break;
+	case PixelFormat::UINT8:
+		pixelType = GL_UNSIGNED_BYTE;
+		break;
+	default:
+		pixelType = GL_FLOAT;
+		break;
+	}
+
+	glBindTexture(type, id);
+	if (OpenGL::error("glBindTexture"))
+		return false;
+
+	const uchar* bytes = (const uchar*)view.bytes();
+	size_t rowBytes = view.rowStride() * formatSize(view.format());
+
+	// GL can only skip over whole pixels between rows
+	if (flip || (view.rowStride() % perPixelChan != 0)) {
+
+		// allocate, then hand over one row at a time
+		glTexImage2D(type, 0, format, width, height, 0, components, pixelType, nullptr);
+		if (OpenGL::error("glTexImage2D"))
+			return false;
+
+		for (uint y = 0; y < height; y++)
+			glTexSubImage2D(type, 0, 0, flip ? height - 1 - y : y, width, 1,
+				components, pixelType, bytes + y * rowBytes);
+
+		if (OpenGL::error("glTexSubImage2D"))
+			return false;
+	}
+	else {
+
+		// step over any row padding, and tell GL how aligned the rows are.
+		//  Packed 8-bit rows can end anywhere
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(view.rowStride() / perPixelChan));
+		glPixelStorei(GL_UNPACK_ALIGNMENT, view.aligned() ? 8 : (rowBytes % 4 == 0) ? 4 : 1);
+		glTexImage2D(type, 0, format, width, height, 0, components, pixelType, bytes);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		if (OpenGL::error("glTexImage2D"))
+			return false;
+	}
+
+	glBindTexture(type, 0);			// unbind and mark as ready to go
+	hasStorage = true;
+
+	return true;
+
+}
+
 // handle sampler settings
 bool SimpleTexture::setDownsampler(GLenum value) {
 
@@ -0,0 +1,86 @@
+#include "global.h"
+
+
+// spin up the workers; they sleep until there's something to do
+ThreadPool::ThreadPool(uint threads) {
+
+	if (threads == 0)
+		threads = thread::hardware_concurrency();
+	if (threads == 0)		// couldn't tell? Play it safe
+		threads = 1;
+
+	for (uint it = 0; it < threads; it++)
+		workers.emplace_back([this]() { work(); });
+
+}
+
+// let the queue drain, then send everyone home
+ThreadPool::~ThreadPool() {
+
+	{
+		std::lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (thread& worker : workers)
+		worker.join();
+
+}
+
+void ThreadPool::submit(function<void()> job) {
+
+	{
+		std::lock_guard<mutex> guard(lock);
+		jobs.push_back(std::move(job));
+		pending++;
+	}
+	wake.notify_one();
+
+}
+
+void ThreadPool::wait() {
+
+	unique_lock<mutex> guard(lock);
+	idle.wait(guard, [this]() { return pending == 0; });
+
+}
+
+bool ThreadPool::wait(microseconds timeout) {
+
+	unique_lock<mutex> guard(lock);
+	return idle.wait_for(guard, timeout, [this]() { return pending == 0; });
+
+}
+
+// take the oldest job, run it outside the lock, repeat
+void ThreadPool::work() {
+
+	while (true) {
+
+		function<void()> job;
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+
+			if (jobs.empty())	// must be stopping
+				return;
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		// one bad job shouldn't take the worker down with it
+		try {
+			job();
+		}
+		catch (...) {
+			cerr << endl << "* ERROR: A pooled job threw an exception." << endl;
+		}
+
+		std::lock_guard<mutex> guard(lock);
+		if (--pending == 0)
+			idle.notify_all();
+	}
+
+}
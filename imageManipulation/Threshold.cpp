@@ -0,0 +1,134 @@
+#include "global.h"
+
+
+// rows summed between checks of the verdict
+static const uint checkRows = 16;
+
+// the bits of value, lowest first, read back the other way round
+static uint reversed(uint value, uint bits) {
+
+	uint out = 0;
+	for (uint it = 0; it < bits; it++, value >>= 1)
+		out = (out << 1) | (value & 1);
+
+	return out;
+
+}
+
+// the largest component of a view that isn't NaN, and -infinity if none are
+static float largest(const ImageView& view) {
+
+	float top = -numeric_limits<float>::infinity();
+	dispatchFormat(view.format(), [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		for (uint y = 0; y < view.height(); y++) {
+
+			Span<const T> row = view.rowAs<T>(y);
+			for (size_t it = 0; it < row.size(); it++) {
+
+				float v = PixelTraits<T>::toFloat(row[it]);
+				top = (v > top) ? v : top;
+			}
+		}
+	});
+
+	return top;
+
+}
+
+
+/* The squared error only ever grows, so once the part summed so far is more
+*  than a pair clearing the threshold could have in total, the rest can't
+*  save it. The bands are visited in bit-reversed order, so however far we
+*  get, what's been summed is spread evenly down the image; a fault in one
+*  part of the frame turns up about as soon as one all over it would. */
+DiffResult Difference::check(const ImageView& first, const ImageView& second,
+	double threshold, float peak)
+{
+	ErrorSums sums;
+	DiffResult out = sums.result();
+
+	if (!first.valid() || !second.valid() ||
+		(first.width() != second.width()) ||
+		(first.height() != second.height()) ||
+		(first.channels() != second.channels()))
+		return out;
+
+	if (isnan(peak))
+		peak = ((first.format() == PixelFormat::UINT8) && (second.format() == PixelFormat::UINT8)) ?
+			1.f : std::max(largest(first), largest(second));
+
+	// the squared error a pair can have in total and still pass
+	ulong total = first.pixels() * first.channels();
+	double limit = (double)total * peak * peak * pow(10.0, -threshold / 10.0);
+
+	uint bands = (first.height() + checkRows - 1) / checkRows;
+	uint bits = 0;
+	while ((1u << bits) < bands)
+		bits++;
+
+	for (uint it = 0; it < (1u << bits); it++) {
+
+		uint band = reversed(it, bits);
+		if (band >= bands)
+			continue;
+
+		uint top = band * checkRows;
+		uint rows = std::min(checkRows, first.height() - top);
+		sums.add(first.region(0, top, first.width(), rows),
+			second.region(0, top, second.width(), rows));
+
+		progress.read((unsigned long long)rows * first.width() * first.channels() *
+			(formatSize(first.format()) + formatSize(second.format())));
+
+		if (sums.squaredError() > limit) {
+
+			out.bound = 20.0 * log10((double)peak) - 10.0 * log10(sums.squaredError() / total);
+			return out;
+		}
+	}
+
+	out = sums.result();
+	out.passed = (out.psnr >= threshold);
+	out.bound = out.psnr;
+	return out;
+
+}
+
+
+// every pair against the threshold; see comparePairs()
+int Difference::compareThreshold(const vector<string>& files, const char* output,
+	const CompareOptions& options)
+{
+	double threshold = options.threshold;
+
+	std::ostringstream mode;
+	mode << "checking against " << threshold << "dB";
+
+	int status = comparePairs(files, output, options, mode.str().c_str(), "VERDICT / PSNR",
+		[threshold](const Image& a, const Image& b)
+		{
+			return check(a.view(), b.view(), threshold, std::max(a.max(), b.max()));
+		},
+		[](ofstream& out, const DiffResult& result)
+		{
+			if (result.passed)
+				out << "pass / " << result.psnr << "dB";
+			else if (isnan(result.psnr) && !isnan(result.bound))
+				out << "fail / <" << result.bound << "dB";	// stopped early
+			else
+				out << "fail / " << result.psnr << "dB";
+		});
+
+	ulong passed = 0;
+	for (const DiffResult& result : state)
+		passed += result.passed;
+
+	ProgressSnapshot done = progress.snapshot();
+	cout << "* " << done.pairs << " pairs checked, " << passed << " passed, reading " <<
+		(int)((done.bytesTotal > 0) ? (100.0 * done.bytes) / done.bytesTotal : 0.0) <<
+		"% of what a full comparison would." << endl;
+
+	return status;
+}
@@ -0,0 +1,319 @@
+#include "global.h"
+
+
+// cells a side of the outlines the bounds come from, at most
+static const uint outlineSize = 128;
+
+// how far (in dB) a bound may be out through rounding, and still be trusted
+static const double slack = 1e-6;
+
+/* An image box-averaged down to a few cells a side. By Cauchy-Schwarz, the
+*  squared differences within a cell add up to at least its pixel count times
+*  the squared difference of the two cell means, so two outlines give a lower
+*  bound on the squared error of the full images for a tiny fraction of the
+*  reading. The sums are kept per cell, rather than the means, and in double,
+*  so the bound can't creep above the real thing through rounding. */
+struct Outline {
+
+	uint scale = 0;			// pixels per cell, each way
+	uint w = 0, h = 0;		// of the image
+	uint width = 0, height = 0;	// in cells
+	uchar channels = 0;
+	vector<double> sums;		// per cell, per channel
+	float max = 0.f;		// of the whole image
+
+};
+
+static Outline outlineOf(const Image& image) {
+
+	Outline out;
+	out.w = image.width();
+	out.h = image.height();
+	out.scale = std::max(1u, (std::max(out.w, out.h) + outlineSize - 1) / outlineSize);
+	out.width = (out.w + out.scale - 1) / out.scale;
+	out.height = (out.h + out.scale - 1) / out.scale;
+	out.channels = image.channels();
+	out.sums.assign((size_t)out.width * out.height * out.channels, 0.0);
+	out.max = image.max();
+
+	uchar c = out.channels;
+	dispatchFormat(image.format(), [&](auto tag) {
+
+		typedef typename decltype(tag)::type T;
+		for (uint y = 0; y < out.h; y++) {
+
+			const T* row = image.rowAs<T>(y).data();
+			double* cells = out.sums.data() + (size_t)(y / out.scale) * out.width * c;
+
+			for (uint x = 0; x < out.w; x++)
+				for (uchar ch = 0; ch < c; ch++)
+					cells[(size_t)(x / out.scale) * c + ch] +=
+						PixelTraits<T>::toFloat(row[(size_t)x * c + ch]);
+		}
+	});
+
+	return out;
+
+}
+
+// the least squared error the full rows of one band of cells could hold.
+//  NaN anywhere makes this NaN, just as it would the real thing
+static double bandBound(const Outline& a, const Outline& b, uint band) {
+
+	uint rows = std::min(a.scale, a.h - band * a.scale);
+	size_t start = (size_t)band * a.width * a.channels;
+
+	double out = 0.0;
+	for (uint cx = 0; cx < a.width; cx++) {
+
+		double pixels = (double)rows * std::min(a.scale, a.w - cx * a.scale);
+		for (uchar ch = 0; ch < a.channels; ch++) {
+
+			size_t it = start + (size_t)cx * a.channels + ch;
+			double d = a.sums[it] - b.sums[it];
+			out += d * d / pixels;
+		}
+	}
+
+	return out;
+
+}
+
+// the best PSNR a squared error of at least lower could give
+static double ceilingOf(double lower, float max, ulong total) {
+
+	return 20.0 * log10((double)max) - 10.0 * log10(lower / total);
+
+}
+
+// the squared error a pair can reach and still score at least bar
+static double limitOf(double bar, float max, ulong total) {
+
+	return (double)total * max * max * pow(10.0, -(bar - slack) / 10.0);
+
+}
+
+// higher PSNR first, then the earlier pair; a total order, so the list
+//  can't depend on which worker got where first
+static bool better(const DiffResult& a, const DiffResult& b) {
+
+	if (a.psnr != b.psnr)
+		return a.psnr > b.psnr;
+	if (a.y != b.y)
+		return a.y < b.y;
+	return a.x < b.x;
+
+}
+
+struct Worse {
+
+	bool operator()(const DiffResult& a, const DiffResult& b) const { return better(a, b); }
+
+};
+
+// the worst pair we're keeping is always on top, ready to be pushed out
+typedef priority_queue<DiffResult, vector<DiffResult>, Worse> TopHeap;
+
+static void keep(TopHeap& heap, const DiffResult& result, uint size) {
+
+	if (heap.size() < size)
+		heap.push(result);
+	else if (better(result, heap.top())) {
+
+		heap.pop();
+		heap.push(result);
+	}
+
+}
+
+// a full list's worst is a bar every pair still to come has to clear
+static double barOf(const TopHeap& heap, uint size) {
+
+	return (heap.size() < size) ? -numeric_limits<double>::infinity() : heap.top().psnr;
+
+}
+
+// only ever raise the shared bar; whoever set it had that many pairs above it
+static void raise(atomic<double>& bar, double value) {
+
+	double now = bar.load(std::memory_order_relaxed);
+	while ((value > now) && !bar.compare_exchange_weak(now, value, std::memory_order_relaxed));
+
+}
+
+
+/* The top pairs, without the matrix. Every image is decoded and outlined
+*  once, then each worker takes every pair of one image with the later ones,
+*  bounds them all from the outlines and works through them most promising
+*  first. Each worker keeps its own list; its worst entry, or the best such
+*  any worker has published, is the bar. A pair whose bound can't clear the
+*  bar is never read, and once one can't, neither can the rest of that
+*  image's. A pair that is read goes a band of cells at a time, and is
+*  abandoned once what it's summed so far plus the bound on the rest can't
+*  clear the bar either. The lists merge into one at the end, so the memory
+*  held for results is a list per task in flight, whatever the image count. */
+int Difference::compareTop(const vector<string>& files, const char* output,
+	const CompareOptions& options)
+{
+	uint count = (uint)files.size();
+	uint size = options.top;
+
+	Job job(options, count);
+	ThreadPool& pool = job.pool;
+	PixelFormat format = job.format;
+	job.announce("Finding the " + std::to_string(size) + " most similar of " +
+		std::to_string(count) + " images' pairs");
+
+	if (options.stream || options.similarity || !options.store.empty() || (options.radius >= 0))
+		cout << "* Only the cache applies to a short list; streaming, SSIM, the store and "
+			"the radius don't." << endl;
+
+	// decode and outline everything
+	vector<Outline> outlines(count);
+	bool complete = loadAll(pool, files, job.cache.get(), &job.buffers, format,
+		[&outlines](uint it, const Image& image) { outlines[it] = outlineOf(image); });
+	job.report();
+
+	ulong loaded = 0;
+	ulong total = 0;
+	for (const shared_ptr<Image>& image : imageVector)
+		if (image != nullptr)
+		{
+			loaded++;
+			total = image->pixels() * image->channels();
+		}
+
+	// every pair might have to be read in full, so that's what we expect
+	ulong pairs = (loaded * (loaded - (loaded > 0))) >> 1;
+	progress.expect(pairs, (unsigned long long)pairs * 2 * total * formatSize(format));
+
+	TopHeap best;
+	atomic<double> bar(-numeric_limits<double>::infinity());
+	atomic<ulong> read(0);
+
+	for (uint a = 0; a + 1 < count; a++)
+	{
+		if (imageVector[a] == nullptr)
+			continue;
+
+		pool.submit([a, count, size, total, &outlines, &best, &bar, &read]()
+		{
+			const Image& image = *imageVector[a];
+			const Outline& outline = outlines[a];
+			uint bands = outline.height;
+
+			// the most promising partners first, so the bar rises quickly
+			vector<pair<double, uint>> order;
+			for (uint b = a + 1; b < count; b++)
+			{
+				if (imageVector[b] == nullptr)
+					continue;
+
+				double lower = 0.0;
+				for (uint band = 0; band < bands; band++)
+					lower += bandBound(outline, outlines[b], band);
+
+				double ceiling = ceilingOf(lower, std::max(outline.max, outlines[b].max), total);
+				if (isnan(ceiling))
+					progress.finished();	// NaN can't make the list anyway
+				else
+					order.push_back(pair<double, uint>(ceiling, b));
+			}
+
+			std::sort(order.begin(), order.end(), [](const pair<double, uint>& l,
+				const pair<double, uint>& r) { return l.first > r.first; });
+
+			TopHeap local;
+			vector<double> lower(bands);
+			for (size_t it = 0; it < order.size(); it++)
+			{
+				auto currentBar = [&]() {
+					return std::max(bar.load(std::memory_order_relaxed), barOf(local, size)); };
+
+				if (order[it].first < currentBar() - slack)
+				{
+					progress.finished((ulong)(order.size() - it));
+					break;		// and so can't any after it
+				}
+
+				uint b = order[it].second;
+				const Image& other = *imageVector[b];
+				float max = std::max(outline.max, outlines[b].max);
+
+				double rest = 0.0;
+				for (uint band = 0; band < bands; band++)
+				{
+					lower[band] = bandBound(outline, outlines[b], band);
+					rest += lower[band];
+				}
+
+				// a band at a time, for as long as the pair could still make it
+				ImageView one = image.view();
+				ImageView two = other.view();
+				ErrorSums sums;
+				bool abandoned = false;
+				for (uint band = 0; band < bands; band++)
+				{
+					uint top = band * outline.scale;
+					uint rows = std::min(outline.scale, image.height() - top);
+					sums.add(one.region(0, top, image.width(), rows),
+						two.region(0, top, image.width(), rows));
+
+					progress.read((unsigned long long)2 * rows * image.width() *
+						image.channels() * formatSize(image.format()));
+
+					rest = std::max(0.0, rest - lower[band]);
+					if (sums.squaredError() + rest > limitOf(currentBar(), max, total))
+					{
+						abandoned = true;
+						break;
+					}
+				}
+
+				progress.finished();
+				if (abandoned)
+					continue;
+
+				read++;
+				DiffResult result = sums.result();
+				result.x = a;
+				result.y = b;
+				if (!isnan(result.psnr))
+				{
+					keep(local, result, size);
+					raise(bar, barOf(local, size));
+				}
+			}
+
+			// once per task, so the lock costs nothing
+			std::lock_guard<mutex> guard(dataLock);
+			for (; !local.empty(); local.pop())
+				keep(best, local.top(), size);
+			raise(bar, barOf(best, size));
+		});
+	}
+	drain(pool);
+
+	cout << "* " << read << " of " << pairs << " pairs had to be read in full." << endl;
+
+	// out of the heap worst first, so fill the list from the back
+	vector<DiffResult> list(best.size());
+	for (size_t it = list.size(); !best.empty(); best.pop())
+		list[--it] = best.top();
+
+	ofstream out(output);
+	if (!out)
+	{
+		cerr << endl << "* ERROR: Could not write \"" << output << "\"." << endl;
+		return -1;
+	}
+
+	out << "rank,first,second,PSNR (dB),RMSE,MAE\n";
+	for (size_t it = 0; it < list.size(); it++)
+		out << (it + 1) << "," << list[it].x << "," << list[it].y << "," << list[it].psnr <<
+			"," << list[it].rmse << "," << list[it].mae << "\n";
+
+	cout << "* Wrote \"" << output << "\"." << endl;
+
+	return complete ? 0 : -1;
+}
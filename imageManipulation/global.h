@@ -28,6 +28,7 @@
 
 
 #include <windows.h>
+#include <malloc.h>	// _aligned_malloc
 #include <GL/gl.h>
 
 // This define clause was causing the inconsistent dll linkage errors.
@@ -43,6 +44,8 @@ using namespace glm;
 
 
 
+#include <cassert>	// checks in debug builds only; release defines NDEBUG
+
 #include <cmath>
 using std::fabs;
 using std::isnan;
@@ -52,9 +55,13 @@ using std::sqrt;
 #include <cstddef>
 using std::size_t;
 
+#include <cstring>
+using std::memcpy;
+
 //#include <unistd.h>	
 // usleep
 #undef max
+#undef min
 
 
 #include <algorithm>
@@ -104,16 +111,39 @@ using std::vector;
 #include <array>
 using std::array;
 
+#include <bitset>
+using std::bitset;
+
+#include <utility>
+using std::pair;
+
 #include <list>
 using std::list;
 
 #include <fstream>
 using std::fstream;
 using std::ifstream;
+using std::ofstream;
+
+#include <condition_variable>
+using std::condition_variable;
+using std::unique_lock;
+
+#include <deque>
+using std::deque;
+
+#include <functional>
+using std::function;
+
+#include <future>
+using std::future;
 
 #include <map>
 using std::map;
 
+#include <queue>
+using std::priority_queue;
+
 #include <random>
 using std::mt19937;
 using std::uniform_int_distribution;
@@ -121,6 +151,9 @@ using std::uniform_int_distribution;
 #include <stdexcept>
 using std::out_of_range;
 
+#include <type_traits>
+using std::integral_constant;
+
 #include <string>
 using std::getline;
 using std::string;
@@ -138,8 +171,17 @@ using std::string;
 typedef unsigned char uchar;
 typedef unsigned int uint;
 typedef unsigned long ulong;
+typedef unsigned short ushort;
 
 // helpful for representing results
+// where a metric is thought to lie, when it's only been estimated
+struct Interval {
+
+	double low = numeric_limits<double>::quiet_NaN();
+	double high = numeric_limits<double>::quiet_NaN();
+
+};
+
 typedef struct DR {
 
 	uint x;				// necessary for sorting
@@ -150,24 +192,514 @@ typedef struct DR {
 	double mae;
 	double rmse;
 
+	double ssim = numeric_limits<double>::quiet_NaN();	// only if asked for
+	double msssim = numeric_limits<double>::quiet_NaN();
+
+	// against a threshold: did the PSNR clear it, and the most it could be.
+	//  A pair that stopped early has only the bound
+	bool passed = false;
+	double bound = numeric_limits<double>::quiet_NaN();
+
+	// estimated from a sample? Then each metric's (about 95%) confidence
+	//  interval, and the fraction of the pixels that were read for it
+	Interval psnrRange, rmseRange, maeRange;
+	double sampled = 1.0;
+
 	// let it be sortable
 	bool operator<(const DR& other) const;
 
 } DiffResult;
 
+// what Difference::similarity() finds
+struct Similarity {
+
+	double ssim = numeric_limits<double>::quiet_NaN();	// at full resolution
+	double msssim = numeric_limits<double>::quiet_NaN();	// over up to five scales
+
+};
+
+// IEEE 754 half precision, stored as raw bits and converted on demand
+struct half {
+
+	ushort bits = 0;
+
+	half() {}
+	half(float f) : bits(fromFloat(f)) {}
+	operator float() const { return toFloat(bits); }
+
+	// round-to-nearest-even, with overflow going to infinity
+	static ushort fromFloat(float f) {
+
+		uint x;
+		memcpy(&x, &f, sizeof(x));
+
+		uint sign = (x >> 16) & 0x8000;
+		int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+		uint mant = x & 0x7fffff;
+
+		if (((x >> 23) & 0xff) == 0xff)		// infinity or NaN
+			return (ushort)(sign | 0x7c00 | (mant ? 0x200 : 0));
+		if (exp >= 31)				// too big
+			return (ushort)(sign | 0x7c00);
+
+		if (exp <= 0) {				// subnormal, or too small
+
+			if (exp < -10)
+				return (ushort)sign;
+
+			mant |= 0x800000;
+			uint shift = 14 - exp;
+			uint h = mant >> shift;
+			uint rem = mant & ((1u << shift) - 1);
+			uint halfway = 1u << (shift - 1);
+			if ((rem > halfway) || ((rem == halfway) && (h & 1)))
+				h++;
+			return (ushort)(sign | h);
+		}
+
+		// a carry out of the mantissa correctly bumps the exponent
+		uint h = ((uint)exp << 10) | (mant >> 13);
+		uint rem = mant & 0x1fff;
+		if ((rem > 0x1000) || ((rem == 0x1000) && (h & 1)))
+			h++;
+		return (ushort)(sign | h);
+	}
+
+	static float toFloat(ushort h) {
+
+		uint sign = (uint)(h & 0x8000) << 16;
+		uint exp = (h >> 10) & 0x1f;
+		uint mant = h & 0x3ff;
+		uint x;
+
+		if (exp == 0) {				// zero or subnormal
+
+			float f = (float)mant * (1.0f / 16777216.0f);
+			return sign ? -f : f;
+		}
+		else if (exp == 31)			// infinity or NaN
+			x = sign | 0x7f800000 | (mant << 13);
+		else
+			x = sign | ((exp + 112) << 23) | (mant << 13);
+
+		float f;
+		memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+};
+
+// how each storage type maps onto the nominal [0,1] range of a float Image
+template <typename T> struct PixelTraits;
+
+template <> struct PixelTraits<uchar> {
+	static float toFloat(uchar v) { return v * (1.0f / 255.0f); }
+	static uchar fromFloat(float v) {
+		return (uchar)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); }
+};
+
+template <> struct PixelTraits<ushort> {
+	static float toFloat(ushort v) { return v * (1.0f / 65535.0f); }
+	static ushort fromFloat(float v) {
+		return (ushort)(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f + 0.5f); }
+};
+
+template <> struct PixelTraits<half> {
+	static float toFloat(half v) { return v; }
+	static half fromFloat(float v) { return half(v); }
+};
+
+template <> struct PixelTraits<float> {
+	static float toFloat(float v) { return v; }
+	static float fromFloat(float v) { return v; }
+};
+
+// every row of pixel storage starts on a cache line, as wide as an AVX-512 load
+const size_t rowAlignment = 64;
+
+/* Pad a row of elements out to a whole number of cache lines, and to a whole
+*  number of pixels, so GL_UNPACK_ROW_LENGTH can describe it. */
+inline size_t paddedStride(size_t elements, size_t elementSize, uchar channels) {
+
+	size_t unit = rowAlignment / elementSize;
+	while ((unit % channels) != 0)		// lcm, the slow and simple way
+		unit += rowAlignment / elementSize;
+
+	return ((elements + unit - 1) / unit) * unit;
+}
+
+// what each component of an Image or ImageView is stored as
+enum class PixelFormat : uchar {
+
+	FLOAT32,		// what stbi_loadf hands us
+	FLOAT16,		// IEEE half
+	UINT16,			// [0, 65535] maps onto [0, 1]
+	UINT8			// [0, 255] maps onto [0, 1], a quarter of the bytes
+
+};
+
+inline size_t formatSize(PixelFormat format) {
+
+	switch (format) {
+
+	case PixelFormat::FLOAT16:
+	case PixelFormat::UINT16:
+		return 2;
+	case PixelFormat::UINT8:
+		return 1;
+	default:
+		return sizeof(float);
+	}
+}
+
+// map a storage type to its format, for the typed code
+template <typename T> struct FormatOf;
+template <> struct FormatOf<float> { static const PixelFormat value = PixelFormat::FLOAT32; };
+template <> struct FormatOf<half> { static const PixelFormat value = PixelFormat::FLOAT16; };
+template <> struct FormatOf<ushort> { static const PixelFormat value = PixelFormat::UINT16; };
+template <> struct FormatOf<uchar> { static const PixelFormat value = PixelFormat::UINT8; };
+
+// and the reverse, for dispatchFormat()
+template <typename T> struct TypeTag { typedef T type; };
+
+/* Bridge a format only known at runtime into compile-time code. The visitor
+*  is called with a TypeTag, so a generic lambda can use
+*  typename decltype(tag)::type as the storage type. */
+template <typename Visitor>
+void dispatchFormat(PixelFormat format, Visitor&& visit) {
+
+	switch (format) {
+
+	case PixelFormat::FLOAT16:
+		visit(TypeTag<half>());
+		break;
+	case PixelFormat::UINT16:
+		visit(TypeTag<ushort>());
+		break;
+	case PixelFormat::UINT8:
+		visit(TypeTag<uchar>());
+		break;
+	default:
+		visit(TypeTag<float>());
+		break;
+	}
+}
+
+// read or write one component of any format, as a float
+inline float readComponent(const uchar* at, PixelFormat format) {
+
+	switch (format) {
+
+	case PixelFormat::FLOAT16:
+		return PixelTraits<half>::toFloat(*(const half*)at);
+	case PixelFormat::UINT16:
+		return PixelTraits<ushort>::toFloat(*(const ushort*)at);
+	case PixelFormat::UINT8:
+		return PixelTraits<uchar>::toFloat(*at);
+	default:
+		return *(const float*)at;
+	}
+}
+
+inline void writeComponent(uchar* at, PixelFormat format, float value) {
+
+	switch (format) {
+
+	case PixelFormat::FLOAT16:
+		*(half*)at = PixelTraits<half>::fromFloat(value);
+		break;
+	case PixelFormat::UINT16:
+		*(ushort*)at = PixelTraits<ushort>::fromFloat(value);
+		break;
+	case PixelFormat::UINT8:
+		*at = PixelTraits<uchar>::fromFloat(value);
+		break;
+	default:
+		*(float*)at = value;
+		break;
+	}
+}
+
+// rowAlignment-aligned storage for count elements, freed automatically
+template <typename T>
+shared_ptr<T> alignedBuffer(size_t count) {
+
+	T* out = static_cast<T*>(_aligned_malloc(count * sizeof(T), rowAlignment));
+	if (out == nullptr)
+		throw std::bad_alloc();
+
+	return shared_ptr<T>(out, [](T* p) { _aligned_free(p); });
+}
+
+// a running double total that keeps the low-order bits plain addition would
+//  drop (Neumaier's take on Kahan summation)
+struct CompensatedSum {
+
+	double sum = 0.0;
+	double carry = 0.0;	// what's been lost from sum so far
+
+	void add(double value) {
+
+		double total = sum + value;
+		if (fabs(sum) >= fabs(value))
+			carry += (sum - total) + value;
+		else
+			carry += (value - total) + sum;
+		sum = total;
+	}
+
+	void add(const CompensatedSum& other) {
+
+		add(other.sum);
+		add(other.carry);
+	}
+
+	double value() const { return sum + carry; }
+
+};
+
+// the instruction sets the metric kernels know, narrowest first
+enum class SimdLevel : uchar { SCALAR, SSE2, AVX2, AVX512 };
+
 
 
 // ***** CLASSES
 
-// represent a pixel
+/* A contiguous run of elements, like one row of an image. Nothing is checked
+*  in release builds, so loops over a Span can vectorize; debug builds assert
+*  on every access instead. */
+template <typename T>
+class Span {
+
+	T* first = nullptr;
+	size_t n = 0;
+
+public:
+	Span() {}
+	Span(T* data, size_t count) : first(data), n(count) {}
+
+	size_t size() const { return n; }
+	T* data() const { return first; }
+	T* begin() const { return first; }
+	T* end() const { return first + n; }
+
+	T& operator[](size_t index) const {
+
+		assert(index < n);
+		return first[index];
+	}
+
+};
+
+// how the components of an Image are arranged in memory
+enum class ImageLayout : uchar {
+
+	INTERLEAVED,		// RGBRGBRGB..., the way STB hands them to us
+	PLANAR			// RRR...GGG...BBB..., one plane per component
+
+};
+
+// summary statistics over every component of an Image
+struct ImageStats {
+
+	static const uint bins = 256;	// histogram resolution over [0,1]
+
+	float min;			// NaN if nothing has been set
+	float max;
+	double mean;
+	double sumSquares;
+	ulong count = 0;		// how many components weren't NaN?
+
+	array<ulong, bins> histogram;	// out-of-range values land in the end bins
+
+};
+
+/* Lazily computed ImageStats, shared by every copy of an Image. Every view
+*  onto the same storage (regions included) shares one version counter, so
+*  a write through any of them marks all of their stats stale with a single
+*  atomic increment, cheap enough to do on every write. */
+class StatsCache {
+
+	mutex lock;				// guards the recomputation
+	shared_ptr<atomic<ulong>> version;	// bumped on every write to the storage
+	ulong seen = 0;				// the version value was computed from
+	shared_ptr<const ImageStats> value;	// the last computed stats
+
+public:
+	// a fresh counter for fresh storage, or an existing one for a region
+	StatsCache(shared_ptr<atomic<ulong>> counter = nullptr) : version(counter) {
+
+		if (!version)
+			version = make_shared<atomic<ulong>>(0);
+	}
+
+	shared_ptr<atomic<ulong>> counter() const { return version; }
+
+	void clear() { version->fetch_add(1, std::memory_order_relaxed); }
+
+	// return the cached stats, calling compute() first if they're stale
+	template <typename Compute>
+	shared_ptr<const ImageStats> get(Compute compute) {
+
+		std::lock_guard<mutex> guard(lock);
+
+		ulong now = version->load(std::memory_order_acquire);
+		if (!value || (now != seen)) {
+
+			seen = now;		// any write from here on forces a redo
+			value = make_shared<const ImageStats>(compute());
+		}
+
+		return value;
+	}
+
+};
+
+/* A read-only window onto tightly packed or strided, interleaved pixels of
+*  any PixelFormat. It doesn't copy anything; whoever made it can hand over
+*  ownership of the underlying allocation (say, an STB buffer) through a
+*  custom deleter, and it's released once the last view onto it goes away. */
+class ImageView {
+
+	const uchar* origin = nullptr;	// the first component of the first row
+	PixelFormat fmt = PixelFormat::FLOAT32;
+	uint w = 0;		// width, height, you get it
+	uint h = 0;
+	uchar c = 0;
+	size_t stride = 0;	// elements between the start of consecutive rows
+
+	shared_ptr<const void> owner;	// keeps the storage alive, if we're told to
+
+public:
+	ImageView() {}		// an invalid view
+	ImageView(const float* data, uint width, uint height, uchar channels,
+		size_t stride = 0, shared_ptr<const void> owner = nullptr);
+	ImageView(const void* data, PixelFormat format, uint width, uint height,
+		uchar channels, size_t stride = 0, shared_ptr<const void> owner = nullptr);
+
+	// decode a file with STB into the given format, without copying the
+	//  result (except for FLOAT16, which STB can't produce). Invalid on failure.
+	//  Note STB gamma-expands 8-bit files into floats; the integers stay raw
+	static ImageView decode(const char* file, PixelFormat format = PixelFormat::FLOAT32);
+
+	bool valid() const { return origin != nullptr; }
+
+	// does every row start on a rowAlignment boundary?
+	bool aligned() const {
+
+		return ((size_t)origin % rowAlignment == 0) &&
+			((stride * formatSize(fmt)) % rowAlignment == 0);
+	}
+
+	ulong pixels() const { return w * h; }	// how many pixels?
+	uint width() const { return w; }	//  and so on...
+	uint height() const { return h; }
+	uchar channels() const { return c; }
+	size_t rowStride() const { return stride; }
+	PixelFormat format() const { return fmt; }
+
+	const void* bytes() const { return origin; }	// any format
+	shared_ptr<const void> storage() const { return owner; }	// null if we don't own it
+	const float* data() const {			// FLOAT32 only
+
+		assert(fmt == PixelFormat::FLOAT32);
+		return (const float*)origin;
+	}
+
+	// unchecked in release builds; T must match the format
+	template <typename T>
+	Span<const T> rowAs(uint y) const {
+
+		assert((y < h) && (FormatOf<T>::value == fmt));
+		return Span<const T>((const T*)origin + y * stride, (size_t)w * c);
+	}
+
+	Span<const float> row(uint y) const { return rowAs<float>(y); }
+
+	// a sub-view sharing our storage and stride. Invalid if it doesn't fit
+	ImageView region(uint x, uint y, uint width, uint height) const;
+
+};
+
+// running totals for a comparison of two images, fed a region at a time
+struct ErrorSums {
+
+	CompensatedSum squared;		// sum of the squared differences
+	CompensatedSum absolute;	//  and of the absolute ones
+
+	// pairs of 8-bit views are summed exactly, in whole steps of 1/255,
+	//  and only scaled down in result()
+	unsigned long long squaredSteps = 0;
+	unsigned long long absoluteSteps = 0;
+	float max = -numeric_limits<float>::infinity();	// in either image
+	ulong count = 0;	// how many components were compared?
+
+	// accumulate two views of identical dimensions, in any pair of formats
+	void add(const ImageView& first, const ImageView& second);
+	void add(const ErrorSums& other);	// fold in another set of totals
+
+	double squaredError() const;	// the squared differences so far, in all
+	double absoluteError() const;	//  and the absolute ones
+	DiffResult result() const;	// turn the totals into metrics
+
+};
+
+// how an ImagePool has been behaving
+struct PoolStats {
+
+	ulong allocations = 0;		// buffers we had to allocate fresh
+	ulong reuses = 0;		// requests handed a recycled buffer
+	size_t bytesInUse = 0;		// handed out right now
+	size_t bytesIdle = 0;		// sitting on the free lists
+	size_t highWater = 0;		// the most ever in use at once
+	size_t highWaterTotal = 0;	// the most ever held, in use or idle
+
+};
+
+/* Recycles pixel buffers between images of the same size. Buffers are
+*  grouped into size classes (rounded up to 4 KiB), are rowAlignment-aligned
+*  and come back to their free list when the last Image using one lets go.
+*  Once a batch of same-size frames has warmed up, building a new Image
+*  allocates nothing. */
+class ImagePool {
+
+	// shared with every outstanding buffer, so it outlives the pool if need be
+	struct State {
+
+		mutex lock;
+		map<size_t, vector<uchar*>> idle;	// free lists, by size class
+		PoolStats stats;
+		bool closed = false;			// pool gone? Then just free
+	};
+
+	shared_ptr<State> state;
+
+	static size_t sizeClass(size_t bytes);	// rounded up
+
+public:
+	ImagePool();
+	~ImagePool();		// frees the idle buffers; the rest free themselves
+
+	shared_ptr<uchar> acquire(size_t bytes);	// room for this many bytes
+	PoolStats stats() const;
+	void trim();		// release every idle buffer
+
+};
+
+// represent a pixel; a thin view into the storage of an Image
 class Pixel {
 	// the components contained within
-	vector<float> c;
-	float maxAll;
+	uchar* c = nullptr;	// the first component
+	PixelFormat fmt = PixelFormat::FLOAT32;
+	uchar n = 0;		// how many components?
+	size_t step = 0;	// distance between components, in bytes
+
+	StatsCache* cache = nullptr;	// the owner's stats, cleared on set()
 
 public:
-	// must fix the number of components from the get-go
-	Pixel(uchar components);
+	// views are handed out by Scanline, so there's no default constructor
+	Pixel(uchar* first, PixelFormat format, uchar components, size_t step,
+		StatsCache* cache = nullptr);
 
 	float r() const;	// handy shortcuts
 	float g() const;
@@ -177,7 +709,7 @@ public:
 	bool g(const float&);
 	bool b(const float&);
 
-	// workhorse functions
+	// workhorse functions; always floats, whatever the storage format
 	bool set(const uchar index, const float& value);
 	float get(const uchar index) const;
 
@@ -188,21 +720,25 @@ public:
 
 	float max() const;	// the maximal value
 
-						// no square brackets, so we can properly update the max value
-
 };
 
-// represent a scanline
+// represent a scanline; a thin view into the storage of an Image
 class Scanline {
 
+	uchar* data = nullptr;	// the first component of the first pixel
+	PixelFormat fmt = PixelFormat::FLOAT32;
 	uint w = 0;		// width of the scanline
-	uint c = 0;		// # of components
+	uchar c = 0;		// # of components
 
-	vector<Pixel> data;	// store data
+	size_t pixelStep = 0;	// distance between pixels, in bytes
+	size_t chanStep = 0;	//  and between the components of a pixel
+
+	StatsCache* cache = nullptr;	// passed along to each Pixel
 
 public:
-	// must fix these from the get-go
-	Scanline(uint width, uchar components);
+	// views are handed out by Image, so there's no default constructor
+	Scanline(uchar* row, PixelFormat format, uint width, uchar components,
+		size_t pixelStep, size_t channelStep, StatsCache* cache = nullptr);
 
 	ulong pixels() const;	// how many pixels?
 	uint width() const;	//  and so on...
@@ -212,40 +748,523 @@ public:
 	float max() const;	// the maximal value
 
 						// access via square brackets; throws exceptions!
-	Pixel& operator[](size_t index);
-	const Pixel& operator[](size_t index) const;
+	Pixel operator[](size_t index);
+	const Pixel operator[](size_t index) const;
 
 };
 
-// represent an image
+// represent an image, stored as one contiguous block in any PixelFormat
 class Image {
 
 	uint w = 0;		// width, height, you get it
 	uint h = 0;
 	uint c = 0;
 
-	vector<Scanline> data;	// store data
+	PixelFormat fmt = PixelFormat::FLOAT32;
+	size_t compSize = sizeof(float);	// bytes per component
+
+	ImageLayout order = ImageLayout::INTERLEAVED;
+	size_t stride = 0;	// components between the start of consecutive rows
+	size_t plane = 0;	// components between consecutive planes
+
+	// every component of every pixel lives here. Shared, so copies of
+	//  this Image are as cheap as the Scanline and Pixel views into it
+	shared_ptr<uchar> buffer;
+	uchar* origin = nullptr;	// our first component; regions start later
+	shared_ptr<StatsCache> cache;	// and so are the stats
+
+	ImageStats computeStats() const;	// one pass over the storage
+	uchar* at(uint x, uint y) const;	// where a pixel starts, in any layout
+	uchar* rowStart(uint y, uchar plane, size_t& length) const;
+
+	template <typename From>
+	void loadFrom(const From* interleaved);	// behind both load()s
+
+	// call visit(start, length) on every contiguous run of components
+	template <typename Visitor>
+	void forEachRun(Visitor visit) const {
+
+		// each run is either a whole interleaved row, or one plane's row
+		uint runs = (order == ImageLayout::PLANAR) ? c : 1;
+		size_t length = (order == ImageLayout::PLANAR) ? w : (size_t)w * c;
+
+		for (uint run = 0; run < runs; run++)
+			for (uint y = 0; y < h; y++)
+				visit(origin + (run * plane + y * stride) * compSize, length);
+	}
 
 public:
-	// must fix these from the get-go
-	Image(uint width, uint height, uchar components);
+	// must fix these from the get-go. With a pool, the storage is recycled
+	//  rather than freshly allocated. Unless clear is false, every component
+	//  starts out NaN (zero for integers); only skip that if you're about to
+	//  write every pixel anyway, as the storage could hold anything
+	Image(uint width, uint height, uchar components,
+		PixelFormat format = PixelFormat::FLOAT32,
+		ImageLayout layout = ImageLayout::INTERLEAVED, ImagePool* pool = nullptr,
+		bool clear = true);
+
+	// adopt storage that already holds an interleaved image of this shape,
+	//  padded just as the constructor above pads it. Say, a mapped file
+	Image(uint width, uint height, uchar components, PixelFormat format,
+		shared_ptr<uchar> storage);
+
+	// an Image of a view, in its format. If the view owns storage padded as
+	//  we'd pad it, that's adopted as is; otherwise it's copied into a buffer
+	//  from the pool. Null if the view is invalid
+	static shared_ptr<Image> from(const ImageView& view, ImagePool* pool = nullptr);
 
 	ulong pixels() const;	// how many pixels?
 	uint width() const;	//  and so on...
 	uint height() const;
 	uchar channels() const;
 
+	PixelFormat format() const;	// what is each component stored as?
+	ImageLayout layout() const;	// how is the storage arranged?
+	size_t rowStride() const;	// components between rows; always a whole
+					//  number of cache lines
+	size_t planeStride() const;	// components between planes (0 if interleaved)
+
+	float* data();		// raw access to FLOAT32 storage; the non-const
+	const float* data() const;	//  version assumes you'll write to it
+
+	// unchecked access for the hot loops; only debug builds assert. A row is
+	//  w*c components if interleaved, or w of the given plane if planar. T
+	//  must match the format. Like data(), the non-const versions assume you'll write
+	template <typename T>
+	Span<T> rowAs(uint y, uchar plane = 0) {
+
+		assert(FormatOf<T>::value == fmt);
+		size_t length;
+		uchar* start = rowStart(y, plane, length);
+		modified();
+
+		return Span<T>((T*)start, length);
+	}
+
+	template <typename T>
+	Span<const T> rowAs(uint y, uchar plane = 0) const {
+
+		assert(FormatOf<T>::value == fmt);
+		size_t length;
+		const uchar* start = rowStart(y, plane, length);
+
+		return Span<const T>((const T*)start, length);
+	}
+
+	Span<float> row(uint y, uchar plane = 0) { return rowAs<float>(y, plane); }
+	Span<const float> row(uint y, uchar plane = 0) const { return rowAs<float>(y, plane); }
+
+	// bulk write of tightly packed, interleaved data, converted to our format.
+	//  Skips the NaN checks of Pixel::set(), and clears the stats just once
+	void load(const float* interleaved);
+	void load(const uchar* interleaved);	// straight from an 8-bit decoder
+	void modified();	// call after writing through an old data() pointer
+
+	shared_ptr<const ImageStats> stats() const;	// computed on first use
 	float max() const;	// the maximal value
 
+	// a zero-copy view, sharing our storage. Invalid if planar
+	ImageView view() const;
+
+	// a sub-image sharing our storage and stride; throws if it doesn't fit
+	Image region(uint x, uint y, uint width, uint height);
+	const Image region(uint x, uint y, uint width, uint height) const;
+
 						// access via square brackets; throws exceptions!
-	Scanline& operator[](size_t index);
-	const Scanline& operator[](size_t index) const;
+	Scanline operator[](size_t index);
+	const Scanline operator[](size_t index) const;
+
+};
+
+/* An image whose storage type and channel count are fixed at compile time,
+*  always interleaved. Channel loops have a constant trip count, so they
+*  unroll and the per-row loops vectorize. Image remains the runtime-typed
+*  version; use dispatchChannels() to hop from one to the other. */
+template <typename T, uchar C>
+class TypedImage {
+
+	static_assert((C >= 1) && (C <= 4),
+		"TypedImage: only 1 to 4 channels are supported");
+
+	uint w = 0;		// width, height, you get it
+	uint h = 0;
+	size_t stride = 0;	// elements between the start of consecutive rows
+
+	shared_ptr<T> buffer;	// one contiguous block, as with Image
+
+public:
+	typedef T value_type;
+	static const uchar components = C;
+
+	// rows aligned and padded like an Image's. From the pool if there is one,
+	//  in which case the storage could hold anything until it's written
+	TypedImage(uint width, uint height, ImagePool* pool = nullptr) : w(width), h(height),
+		stride(paddedStride((size_t)width * C, sizeof(T), C)) {
+
+		if (pool == nullptr)
+			buffer = alignedBuffer<T>(stride * height);
+		else {
+
+			shared_ptr<uchar> storage = pool->acquire(stride * height * sizeof(T));
+			buffer = shared_ptr<T>(storage, (T*)storage.get());
+		}
+	}
+
+	// adopt existing, tightly packed storage
+	TypedImage(uint width, uint height, shared_ptr<T> storage) :
+		w(width), h(height), stride((size_t)width * C), buffer(storage) {}
+
+	// convert from a runtime-typed Image; throws if the channels disagree
+	explicit TypedImage(const Image& src) : TypedImage(src.width(), src.height()) {
+
+		if (src.channels() != C)
+			throw new out_of_range("TypedImage: Channel count mismatch");
+
+		for (uint y = 0; y < h; y++) {
+
+			const Scanline line = src[y];
+			Span<T> out = row(y);
+			for (uint x = 0; x < w; x++)
+				for (uchar c = 0; c < C; c++)
+					out[x * C + c] = PixelTraits<T>::fromFloat(line[x].get(c));
+		}
+	}
+
+	ulong pixels() const { return w * h; }	// how many pixels?
+	uint width() const { return w; }	//  and so on...
+	uint height() const { return h; }
+	uchar channels() const { return C; }
+	size_t rowStride() const { return stride; }
+
+	T* data() { return buffer.get(); }	// raw access to the storage
+	const T* data() const { return buffer.get(); }
+
+	// unchecked row access, for the hot loops; debug builds assert
+	Span<T> row(uint y) {
+
+		assert(y < h);
+		return Span<T>(buffer.get() + y * stride, (size_t)w * C);
+	}
+
+	Span<const T> row(uint y) const {
+
+		assert(y < h);
+		return Span<const T>(buffer.get() + y * stride, (size_t)w * C);
+	}
+
+	// a zero-copy view, sharing our storage
+	ImageView view() const {
+
+		return ImageView(buffer.get(), FormatOf<T>::value, w, h, C, stride, buffer);
+	}
+
+	// convert back into a runtime-typed Image of the same format; lossless
+	Image toImage() const {
+
+		Image out(w, h, C, FormatOf<T>::value);
+		for (uint y = 0; y < h; y++) {
+
+			Span<const T> in = row(y);
+			memcpy(out.rowAs<T>(y).data(), in.data(), (size_t)w * C * sizeof(T));
+		}
+
+		return out;
+	}
+
+};
+
+// the common members of the family
+typedef TypedImage<uchar, 1> ImageR8;
+typedef TypedImage<uchar, 3> ImageRGB8;
+typedef TypedImage<uchar, 4> ImageRGBA8;
+typedef TypedImage<ushort, 3> ImageRGB16;
+typedef TypedImage<half, 3> ImageRGB16F;
+typedef TypedImage<float, 1> ImageR32F;
+typedef TypedImage<float, 3> ImageRGB32F;
+typedef TypedImage<float, 4> ImageRGBA32F;
+
+/* Bridge a channel count only known at runtime (say, from stbi_loadf) into
+*  compile-time code. The visitor is called with an integral_constant, so
+*  a generic lambda can use decltype(c)::value as a template argument.
+*  Returns false for anything STB wouldn't hand us, which is 1 to 4. */
+template <typename Visitor>
+bool dispatchChannels(uchar channels, Visitor&& visit) {
+
+	switch (channels) {
+
+	case 1:
+		visit(integral_constant<uchar, 1>());
+		return true;
+	case 2:
+		visit(integral_constant<uchar, 2>());
+		return true;
+	case 3:
+		visit(integral_constant<uchar, 3>());
+		return true;
+	case 4:
+		visit(integral_constant<uchar, 4>());
+		return true;
+	}
+
+	return false;
+}
+
+/* A fixed set of worker threads, one per core unless told otherwise, fed
+*  from a single queue. Cheaper than a thread per job, and the pool never
+*  has more jobs running than there are cores to run them. */
+class ThreadPool {
+
+	vector<thread> workers;
+	deque<function<void()>> jobs;		// waiting to run, oldest first
+
+	mutex lock;				// protects everything below
+	condition_variable wake;		// a job arrived, or we're stopping
+	condition_variable idle;		// pending hit zero
+	ulong pending = 0;			// queued or running
+	bool stopping = false;
+
+	void work();			// the loop each worker runs
+
+public:
+	ThreadPool(uint threads = 0);		// 0 = one per hardware thread
+	~ThreadPool();			// finishes the queue, then joins
+
+	uint size() const { return (uint)workers.size(); }
+
+	void submit(function<void()> job);	// run this on some worker
+	void wait();			// block until every job so far has finished
+	bool wait(microseconds timeout);	//  or until the timeout; true if idle
+
+	// run this on some worker, and hand back its result (or exception) later
+	template <typename Job>
+	future<decltype(std::declval<Job>()())> async(Job job) {
+
+		typedef decltype(job()) Result;
+		auto task = make_shared<std::packaged_task<Result()>>(std::move(job));
+		future<Result> out = task->get_future();
+
+		submit([task]() { (*task)(); });
+		return out;
+	}
+
+};
+
+// where a job stood at one moment; see JobProgress
+struct ProgressSnapshot {
+
+	ulong pairs = 0;		// pairs finished
+	ulong pairsTotal = 0;		//  out of this many
+	unsigned long long bytes = 0;	// pixel data read by the metrics
+	unsigned long long bytesTotal = 0;
+
+	float elapsed = 0.f;		// seconds since the job began
+	float eta = numeric_limits<float>::quiet_NaN();	// seconds left, if we can tell
+
+};
+
+/* Counters for a long comparison job. The workers bump them with relaxed
+*  atomics, so nothing on the hot path ever waits; anyone can take a
+*  snapshot whenever they like. */
+class JobProgress {
+
+	atomic<ulong> pairs;
+	atomic<ulong> pairsTotal;
+	atomic<unsigned long long> bytes;
+	atomic<unsigned long long> bytesTotal;
+
+	atomic<steady_clock::rep> started;	// steady_clock ticks
+
+public:
+	JobProgress();
+
+	void begin();			// zero the counters, and start the clock
+	void expect(ulong pairCount, unsigned long long byteCount);	// the totals
+
+	void read(unsigned long long count) { bytes.fetch_add(count, std::memory_order_relaxed); }
+	void finished(ulong count = 1) { pairs.fetch_add(count, std::memory_order_relaxed); }
+
+	ProgressSnapshot snapshot() const;
+
+};
+
+/* Decoded images kept on disk between runs, one raw file apiece, so an
+*  unchanged set of inputs is only ever decoded once. Each entry is named
+*  after the source's full path and the format, and remembers the source's
+*  size, last write time and FNV-1a hash. Size and time are checked first, so
+*  a hit costs a stat and a map; a source that was touched but not changed is
+*  caught by the hash. Hits are mapped copy-on-write, straight into an Image,
+*  so nothing is read until the pixels are. Safe to share between threads. */
+class DecodeCache {
+
+	// how every entry starts; the pixels follow at dataOffset, laid out just
+	//  as an interleaved Image would lay them out
+	struct Header {
+
+		char magic[8];
+		unsigned long long size;	// of the source, in bytes
+		unsigned long long modified;	// its last write, as a FILETIME
+		unsigned long long hash;	// FNV-1a of its contents
+		uint w, h;
+		uchar c;
+		PixelFormat fmt;
+	};
+
+	static const char magic[8];
+	static const size_t dataOffset;		// a page in, so rows stay aligned
+
+	string directory;
+	atomic<ulong> hits;
+	atomic<ulong> misses;
+
+	string entryFor(const char* file, PixelFormat format) const;
+	bool store(const string& entry, const Header& header, const Image& image) const;
+
+public:
+	DecodeCache(const string& directory);	// created, if need be
+
+	// the decoded file, from the cache if it's there and still current,
+	//  otherwise decoded (into a buffer from buffers, if given) and then
+	//  cached. nullptr if it can't be decoded
+	shared_ptr<Image> load(const char* file, PixelFormat format = PixelFormat::FLOAT32,
+		ImagePool* buffers = nullptr);
+
+	ulong hitCount() const { return hits.load(); }
+	ulong missCount() const { return misses.load(); }
+
+	// FNV-1a of a file's contents; 0 if it can't be read
+	static unsigned long long hash(const char* file);
+
+};
+
+/* Every DiffResult worked out so far, kept on disk and keyed by the content
+*  hashes of the two images and the format they were compared in. A pair
+*  that hasn't changed never needs comparing again, whatever the files are
+*  called now or wherever they sit in the list. Not thread-safe; compare()
+*  only touches it from its own thread. */
+class ResultStore {
+
+	struct Key {
+
+		unsigned long long first;	// content hashes, the smaller first
+		unsigned long long second;
+		PixelFormat fmt;
+
+		bool operator<(const Key& other) const;
+	};
+
+	// what goes in the file for each result, after a magic and a count
+	struct Record {
+
+		Key key;
+		double psnr, rmse, mae;
+		double ssim, msssim;
+	};
+
+	static const char magic[8];
+
+	string path;
+	map<Key, DiffResult> results;
+	bool changed = false;
+
+	static Key keyFor(unsigned long long a, unsigned long long b, PixelFormat format);
+
+public:
+	ResultStore(const string& path);	// loads whatever's there already
+
+	// the result for this pair of contents, if we have one; x and y are unset
+	bool find(unsigned long long a, unsigned long long b, PixelFormat format,
+		DiffResult& out) const;
+	void put(unsigned long long a, unsigned long long b, PixelFormat format,
+		const DiffResult& result);
+
+	size_t size() const { return results.size(); }
+	bool save();		// if anything changed; false if it couldn't be
 
 };
 
+// compact fingerprints of an image, for finding near-duplicates cheaply
+struct Signature {
+
+	unsigned long long phash = 0;	// signs of the low DCT terms of 32x32 luma
+	bool valid = false;
+
+	// one pass over any view, in any format
+	static Signature of(const ImageView& view);
+
+	// how many bits two hashes differ by
+	static uint distance(unsigned long long a, unsigned long long b) {
+		return (uint)bitset<64>(a ^ b).count(); }
+
+};
+
+/* A BK-tree of 64-bit hashes under Hamming distance. Each child hangs off
+*  its parent by their distance, so by the triangle inequality a query only
+*  has to follow the edges within radius of its own distance to the node.
+*  Small radii touch a small part of the tree, which makes finding every
+*  close pair among n hashes roughly n log n rather than n^2. */
+class SignatureIndex {
+
+	struct Node {
+
+		unsigned long long hash;
+		uint id;
+		map<uint, uint> children;	// by distance, to an index into nodes
+	};
+
+	vector<Node> nodes;
+
+public:
+	void insert(unsigned long long hash, uint id);
+	size_t size() const { return nodes.size(); }
+
+	// the id of every hash within radius bits of this one, itself included
+	vector<uint> query(unsigned long long hash, uint radius) const;
+
+	// every pair of ids within radius bits of each other, the smaller first
+	vector<pair<uint, uint>> pairs(uint radius) const;
+
+};
 
+// how Difference::compare() should go about it
+struct CompareOptions {
 
+	bool stream = false;		// keep just a strip of each image in memory
+	bool similarity = false;	// SSIM and MS-SSIM too; not when streaming
+	string cache;			// keep decoded images here between runs, if set
 
+	// remember every result here, and only compare pairs it doesn't know
+	string store;
+
+	// if 0 to 64, only compare pairs whose pHashes are at most this many
+	//  bits apart. The rest come out as NaN; every image is still decoded
+	//  once, and signed as it is
+	int radius = -1;
+
+	// decode as 8-bit and compare exactly in integers. STB won't
+	//  gamma-expand the bytes, so the numbers differ from the float path
+	bool exact = false;
+
+	// if set, find only this many of the most similar pairs (by PSNR) and
+	//  list them, rather than writing the whole matrix. Pairs that provably
+	//  can't make the list are skipped, mostly before they're read in full
+	uint top = 0;
+
+	// if set, only say whether each pair's PSNR clears this many dB. Failing
+	//  pairs stop as soon as they're sure to, usually after a few rows
+	double threshold = numeric_limits<double>::quiet_NaN();
+
+	// if set, estimate each pair from a stratified sample of rows, refined
+	//  until its PSNR is known to within this many dB, about 95% of the time
+	double tolerance = numeric_limits<double>::quiet_NaN();
+
+	// if set, compare every file against this one and nothing else, writing
+	//  each result out as soon as it's in
+	string reference;
+
+	// hears about the progress once a second, if set
+	function<void(const ProgressSnapshot&)> observer;
+
+};
 
 class SimpleTexture;
 class VertexArray;
@@ -253,22 +1272,157 @@ class VertexArray;
 // A java-ish container for program code
 class Difference {
 
-//	static vector<shared_ptr<Image>> imageVector;	// allow multiple comparisons
-//	static vector<DiffResult> state;		// what are the results?
-//	static mutex dataLock;				// protect the above
-
-//	static atomic<int> activeThreads;		// how many loading routines are running?
+	static vector<shared_ptr<Image>> imageVector;	// allow multiple comparisons
+	static vector<DiffResult> state;		// what are the results? By linearize()
+	static mutex dataLock;				// protect the above, when merging
+
+	// pairs already known from a ResultStore (or ruled out by the
+	//  prefilter), by linearize(); never compared
+	static vector<bool> settled;
+	static bool needed(uint image);		// in any pair that isn't settled?
+	static bool pending(uint first, uint second);	// any in these blocks?
+
+	// settle every pair whose signatures are more than radius bits apart,
+	//  or that has an image without one
+	static void prefilter(const vector<Signature>& signatures, uint radius);
+
+	// called every so often while compare() waits on the workers
+	static function<void(const ProgressSnapshot&)> observer;
+	static void drain(ThreadPool& pool);		// wait, keeping the observer posted
+
+	// wait for a result, likewise
+	template <typename T>
+	static T collect(future<T>& result) {
+
+		while (observer && (result.wait_for(microseconds(1000000)) != std::future_status::ready))
+			observer(progress.snapshot());
+		return result.get();
+	}
+
+	// tell progress what's coming: the unsettled pairs of whatever made it
+	//  into imageVector, or of every image if we don't know yet
+	static void expectWork(ulong total, PixelFormat format, bool loadedOnly = true);
+
+	static int linearize(uint x, uint y);		// turn this into a linear index
+
+	static const uint blockImages;		// images per block when comparing many
+	static const size_t cacheBudget;	// bytes of stripe we try to keep cached
+	static const size_t streamBudget;	// bytes of strips held when streaming
+	static const uint decodeWindow;		// images decoding at once, at most
+
+	/* What every mode sets up the same way: the workers, the cache and pool
+	*  the images come through, and the format they're decoded into. Making
+	*  one starts a job, with imageVector empty for images images, state and
+	*  settled empty, and the observer and progress pointed at it. Letting it
+	*  go ends the job, handing every image it decoded back. */
+	struct Job {
+
+		ThreadPool pool;
+		shared_ptr<DecodeCache> cache;	// if options.cache is set
+		ImagePool buffers;
+		PixelFormat format;
+		bool exact;
+
+		Job(const CompareOptions& options, uint images);
+		~Job();
+
+		// "* what on N threads, how." and so on
+		void announce(const string& what, const string& how = "") const;
+		void report() const;		// how the cache and the pool did
+	};
+
+	// the matrix layout: a row of indices, then a row per image with diagonal
+	//  on the diagonal and cell writing every other pair. False if output
+	//  couldn't be written
+	static bool writeMatrix(const char* output, uint count, const char* diagonal,
+		const function<void(ofstream&, const DiffResult&)>& cell);
+
+	// how the pairs are cut into tasks; see planBlocks()
+	struct BlockPlan {
+
+		uint block = 0;		// images per block
+		uint rows = 0;		// rows per cache-sized stripe
+		uint span = 0;		// rows per task, a whole number of stripes
+		uint height = 0;	// rows per image
+		ulong total = 0;	// components per image, for the progress
+	};
+
+	// sum every pair between two blocks of images (or within one, if they're
+	//  the same) over rows [top, bottom), a stripe at a time, then merge into
+	//  sums. total is the component count of a whole image, for the progress
+	static void compareBlock(vector<ErrorSums>& sums, uint first, uint second,
+		uint top, uint bottom, uint rows, ulong total);
+
+	// cut count images shaped like sample into tasks, then hand out every
+	//  task for one pair of blocks. scheduleBlocks() does the lot, and waits
+	static BlockPlan planBlocks(uint count, const Image& sample, uint height,
+		ulong total, uint threads);
+	static void submitBlocks(ThreadPool& pool, vector<ErrorSums>& sums,
+		const BlockPlan& plan, uint first, uint second);
+	static void scheduleBlocks(ThreadPool& pool, vector<ErrorSums>& sums,
+		uint height, ulong total);
+
+	// the two ways to fill in sums; false if any image couldn't be used. With
+	//  a radius (0 to 64), each image is signed as it's loaded, and the pairs
+	//  too far apart are settled by prefilter() before any are compared
+	static bool compareInMemory(ThreadPool& pool, vector<ErrorSums>& sums,
+		const vector<string>& files, DecodeCache* cache, ImagePool* buffers,
+		PixelFormat format, int radius = -1);
+	static bool compareStreaming(ThreadPool& pool, vector<ErrorSums>& sums,
+		const vector<string>& files, const char* output, DecodeCache* cache,
+		ImagePool* buffers, PixelFormat format, int radius = -1);
+
+	// decode every file into imageVector, a window at a time, handing each
+	//  image to prepare (if set) on the worker that decoded it. Anything that
+	//  won't load, or doesn't match the first that did, is left out; false if
+	//  anything was
+	static bool loadAll(ThreadPool& pool, const vector<string>& files,
+		DecodeCache* cache, ImagePool* buffers, PixelFormat format,
+		const function<void(uint, const Image&)>& prepare = nullptr);
+
+	// just the options.top most similar pairs, listed as CSV; see TopPairs.cpp
+	static int compareTop(const vector<string>& files, const char* output,
+		const CompareOptions& options);
+
+	// every pair as its own task, measured by measure and written out in
+	//  the matrix layout by cell; mode describes it, and labels the diagonal
+	static int comparePairs(const vector<string>& files, const char* output,
+		const CompareOptions& options, const char* mode, const char* diagonal,
+		const function<DiffResult(const Image&, const Image&)>& measure,
+		const function<void(ofstream&, const DiffResult&)>& cell);
+
+	// every pair's verdict against options.threshold; see Threshold.cpp
+	static int compareThreshold(const vector<string>& files, const char* output,
+		const CompareOptions& options);
+
+	// every pair estimated to within options.tolerance; see Estimate.cpp
+	static int compareEstimated(const vector<string>& files, const char* output,
+		const CompareOptions& options);
+
+	// every file against options.reference alone; see Reference.cpp
+	static int compareReference(const vector<string>& files, const char* output,
+		const CompareOptions& options);
 
-//	int linearize(uint x, uint y);		// turn this into a linear index
-
-//	static const double maxPrecisLoss;	// how much precision are we willing to lose?
 
 public:
 	// the ACTUAL main routine
 	int run(const int argc, const char** argv);
 
-	// load the given image
-//	static void loadImage(const char*, uint index);
+	// compare every pair of files headlessly, writing the symmetric matrix
+	//  out as CSV. Returns non-zero if any image couldn't be used. Streaming
+	//  keeps only a strip of each image in memory, at the cost of a spill to disk.
+	//  Only one of reference, top, threshold and tolerance is used, whichever
+	//  comes first in that order; main() won't accept more than one
+	int compare(const vector<string>& files, const char* output = "output.csv",
+		const CompareOptions& options = CompareOptions());
+
+	// how the current (or last) job is going; safe to call from any thread
+	static JobProgress progress;
+
+	// load the given image as FLOAT32 or UINT8, through the cache if given
+	//  and into a recycled buffer if there's a pool; nullptr if it can't be
+	static shared_ptr<Image> loadImage(const char* file, DecodeCache* cache = nullptr,
+		PixelFormat format = PixelFormat::FLOAT32, ImagePool* buffers = nullptr);
 
 
 	static shared_ptr<SimpleTexture> loadImageDataIntoTexture(const char *, uint index);
@@ -279,8 +1433,33 @@ public:
 	vector<GLfloat> getVectorOfImageData(const char* file);
 
 
-	// calculate the metrics
-//	static void calcMetrics(uint x, uint y);
+	// compare two views directly; both must have the same dimensions
+	static DiffResult measure(const ImageView& first, const ImageView& second);
+
+	// does the PSNR of two views of the same shape clear threshold dB? Bands
+	//  of rows are summed in a stratified order, and a pair that can't clear
+	//  it stops there, with psnr and the rest NaN and bound the most it could
+	//  be. peak must be at least the largest component of either; unless
+	//  given, 8-bit is taken as 1 and anything else is scanned for it
+	static DiffResult check(const ImageView& first, const ImageView& second,
+		double threshold, float peak = numeric_limits<float>::quiet_NaN());
+
+	// estimate the metrics of two views of the same shape from a stratified
+	//  random sample of rows, doubling it until the PSNR's interval is
+	//  within tolerance dB either side, and handing each estimate to step
+	//  (if set) on the way. If it would take half the image, it measures the
+	//  lot instead. peak is the largest component of either, if known;
+	//  otherwise the largest sampled stands in for it
+	static DiffResult estimate(const ImageView& first, const ImageView& second,
+		double tolerance, float peak = numeric_limits<float>::quiet_NaN(),
+		const function<void(const DiffResult&)>& step = nullptr);
+
+	// SSIM and MS-SSIM of two FLOAT32 views of the same shape, using 11x11
+	//  Gaussian windows. Bands of rows are spread across the pool, if given;
+	//  don't pass the pool you're running on, as this waits on it. The
+	//  smaller scales come out of buffers, if given
+	static Similarity similarity(const ImageView& first, const ImageView& second,
+		ThreadPool* pool = nullptr, ImagePool* buffers = nullptr);
 
 };
 
@@ -321,7 +1500,8 @@ public:
 	SimpleTexture(uint width, uint height, GLenum format);
 	~SimpleTexture();
 
-	bool load(vector<float> data);	// load up the texture with external data
+	bool load(const vector<float>& data);	// load up the texture with external data
+	bool load(const ImageView& view, bool flip = false);	//  or directly from a view
 	bool load();				// internally allocate some space
 	bool isLoaded() { return hasStorage && (perPixelChan != 0); }
 
@@ -535,4 +1715,19 @@ public:
 
 int main(const int argc, const char** argv);		// the main routine
 
+// the widest kernels this CPU (and OS) can run; checked once
+SimdLevel simdLevel();
+
+// add the squared and absolute differences of count floats onto the sums.
+//  Each difference is taken in double precision, and blocks are folded in
+//  with compensation. Asking for more than simdLevel() gets simdLevel()
+void differenceSums(const float* a, const float* b, size_t count,
+	CompensatedSum& squared, CompensatedSum& absolute, SimdLevel level = simdLevel());
+
+// the same for count bytes, in whole 8-bit steps and exactly, and raise max
+//  to the largest component of either
+void differenceSums(const uchar* a, const uchar* b, size_t count,
+	unsigned long long& squared, unsigned long long& absolute, uchar& max,
+	SimdLevel level = simdLevel());
+
 #endif
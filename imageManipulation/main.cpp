@@ -13,6 +13,72 @@ using std::string;
 int main(int argc, const char** argv) {
 
 	Difference diff;
+
+	// more than one image? Then there's a matrix to build, and no window.
+	//  --stream keeps just a strip of each image in memory, --ssim adds SSIM,
+	//  --cache DIR keeps decoded images in DIR for the next run, --store FILE
+	//  keeps every result in FILE so unchanged pairs aren't compared again,
+	//  --radius N only compares pairs whose pHashes are within N bits, and
+	//  --exact compares 8-bit sources as bytes, --top K lists just the K most
+	//  similar pairs, --threshold DB just says which pairs clear DB, and
+	//  --estimate DB samples each pair until its PSNR is known to within DB.
+	//  --reference FILE compares every image against FILE alone. Only one of
+	//  --reference, --top, --threshold and --estimate may be given
+	if (argc > 2) {
+
+		CompareOptions options;
+		int first = 1;
+		for (; first < argc; first++) {
+
+			string flag = argv[first];
+			if (flag == "--stream")
+				options.stream = true;
+			else if (flag == "--ssim")
+				options.similarity = true;
+			else if (flag == "--exact")
+				options.exact = true;
+			else if ((flag == "--cache") && (first + 1 < argc))
+				options.cache = argv[++first];
+			else if ((flag == "--store") && (first + 1 < argc))
+				options.store = argv[++first];
+			else if ((flag == "--radius") && (first + 1 < argc))
+				options.radius = atoi(argv[++first]);
+			else if ((flag == "--top") && (first + 1 < argc))
+				options.top = (uint)std::max(0, atoi(argv[++first]));
+			else if ((flag == "--threshold") && (first + 1 < argc))
+				options.threshold = atof(argv[++first]);
+			else if ((flag == "--estimate") && (first + 1 < argc))
+				options.tolerance = atof(argv[++first]);
+			else if ((flag == "--reference") && (first + 1 < argc))
+				options.reference = argv[++first];
+			else
+				break;
+		}
+		vector<string> files(argv + first, argv + argc);
+
+		// each of these is its own way of comparing, so only one at a time
+		int modes = !options.reference.empty() + (options.top > 0) +
+			!isnan(options.threshold) + !isnan(options.tolerance);
+		if (modes > 1)
+		{
+			cerr << endl << "* ERROR: --reference, --top, --threshold and --estimate "
+				"can't be combined; pick one." << endl;
+			return -1;
+		}
+
+		// long jobs are dull enough without silence
+		options.observer = [](const ProgressSnapshot& now) {
+
+			cout << "* " << now.pairs << " of " << now.pairsTotal << " pairs, " <<
+				(now.bytes >> 20) << " MiB read";
+			if (!isnan(now.eta))
+				cout << ", about " << (int)now.eta << "s left";
+			cout << "." << endl;
+		};
+
+		return diff.compare(files, "output.csv", options);
+	}
+
 	GOL gol;
 	
 